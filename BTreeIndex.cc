@@ -9,15 +9,456 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <sys/stat.h>
 
 using namespace std;
 
+/*
+ * The layout of page 0 of the index file. Files written before the
+ * format version was added hold only rootPid and treeHeight, files
+ * of version 1 end with maxKey and files of version 2 with tableEnd.
+ */
+struct BTreeMeta {
+    PageId rootPid;
+    int    treeHeight;
+    int    formatVersion;  // INDEX_FORMAT_VERSION
+    int    pageSize;       // the page size of the file
+    int    keyCount;       // the # of (key, RecordId) entries. -1 if not known
+    int    minKey;         // the smallest and the largest key.
+    int    maxKey;         //   valid only if keyCount > 0
+    RecordId tableEnd;     // the end of the table when the index was last
+                           //   updated. (-1, -1) if not known
+    PageId runPid;         // the shared posting page being filled
+};
+
+static const int INDEX_FORMAT_VERSION = 3;
+
+/*
+ * The version of a cursor whose leaf was not read yet. Versions returned
+ * by VersionLatch::readLock() are even, so this never matches one.
+ */
+static const uint64_t STALE_VERSION = 1;
+
+/*
+ * A leaf entry whose RecordId has this sid refers to the chain of posting
+ * pages starting at page pid. The sid of a record is never negative.
+ */
+static const int POSTING_SID = -1;
+
+/*
+ * A posting page of a chain starts with the # of RecordIds in the page
+ * and the next page of the chain (-1 for the last one). The first page
+ * of a chain also records the last page, where RecordIds are appended,
+ * and the # of RecordIds in the whole chain. The RecordIds follow the
+ * header.
+ */
+#define POSTING_COUNT        0
+#define POSTING_NEXT         (sizeof(int))
+#define POSTING_TAIL         (sizeof(int) + sizeof(PageId))
+#define POSTING_TOTAL        (sizeof(int) + 2*sizeof(PageId))
+#define POSTING_HEADER_SIZE  (2*sizeof(int) + 2*sizeof(PageId))
+#define POSTING_CAPACITY(size) ((int)(((size) - POSTING_HEADER_SIZE) / sizeof(RecordId)))
+#define POSTING_RID(buf, eid)  ((buf) + POSTING_HEADER_SIZE + (eid)*sizeof(RecordId))
+
+/*
+ * A short posting list is a run in a shared posting page, which holds the
+ * runs of many keys. A leaf entry whose sid is below POSTING_SID refers to
+ * the run in slot POSTING_SID - 1 - sid of the shared page pid. The page
+ * starts with the # of slots and the offset where the runs begin, followed
+ * by the offsets of the runs in slot order. The runs are placed from the
+ * end of the page towards the slots, and start with the # of RecordIds in
+ * the run and its capacity. A full run is copied into one twice as large,
+ * and a list that outgrows MAX_RUN_SIZE moves to a chain of its own. The
+ * space of a run left behind is not used again.
+ */
+#define RUN_SID(slot)        (POSTING_SID - 1 - (slot))
+#define RUN_SLOT(sid)        (POSTING_SID - 1 - (sid))
+#define SHARED_SLOTS         0
+#define SHARED_START         (sizeof(int))
+#define SHARED_HEADER_SIZE   (2*sizeof(int))
+#define SHARED_SLOT(slot)    (SHARED_HEADER_SIZE + (slot)*sizeof(int))
+#define RUN_COUNT            0
+#define RUN_CAPACITY         (sizeof(int))
+#define RUN_HEADER_SIZE      (2*sizeof(int))
+#define RUN_SIZE(capacity)   ((int)(RUN_HEADER_SIZE + (capacity)*sizeof(RecordId)))
+#define RUN_RID(run, eid)    ((run) + RUN_HEADER_SIZE + (eid)*sizeof(RecordId))
+#define MAX_RUN_SIZE(size)   (max(2, POSTING_CAPACITY(size) / 8))
+
+static inline int getField(const char* page, size_t offset)
+{
+    int value;
+    memcpy(&value, page + offset, sizeof(int));
+    return value;
+}
+
+static inline void setField(char* page, size_t offset, int value)
+{
+    memcpy(page + offset, &value, sizeof(int));
+}
+
+/*
+ * Find a run in a shared posting page. A torn or damaged slot gives no
+ * run, and the count is kept within the capacity and the page.
+ * @param page[IN] the shared posting page
+ * @param pageSize[IN] the size of the page
+ * @param slot[IN] the slot of the run
+ * @param count[OUT] the # of RecordIds in the run
+ * @param capacity[OUT] the # of RecordIds the run can hold
+ * @return the run. NULL if the page has no such run
+ */
+static char* findRun(char* page, int pageSize, int slot, int& count, int& capacity)
+{
+    int slots = getField(page, SHARED_SLOTS);
+    if (slot < 0 || slot >= slots || SHARED_SLOT(slots) > (size_t)pageSize) {
+        return NULL;
+    }
+    int offset = getField(page, SHARED_SLOT(slot));
+    if (offset < (int)SHARED_SLOT(slots) || offset > pageSize - RUN_SIZE(0)) {
+        return NULL;
+    }
+    char* run = page + offset;
+    int room = (pageSize - offset - RUN_SIZE(0)) / (int)sizeof(RecordId);
+    capacity = max(min(getField(run, RUN_CAPACITY), room), 0);
+    count = max(min(getField(run, RUN_COUNT), capacity), 0);
+    return run;
+}
+
+/*
+ * Wait until no writer holds the latch.
+ * @return the current version
+ */
+uint64_t VersionLatch::readLock() const
+{
+    uint64_t version = word.load(memory_order_acquire);
+    while (version & 1) {
+        this_thread::yield();
+        version = word.load(memory_order_acquire);
+    }
+    return version;
+}
+
+/*
+ * @param version[IN] a version returned by readLock()
+ * @return true if nothing was written since version was read
+ */
+bool VersionLatch::validate(uint64_t version) const
+{
+    // the reads of the node must happen before the version is read again
+    atomic_thread_fence(memory_order_acquire);
+    return word.load(memory_order_relaxed) == version;
+}
+
+/*
+ * Take the latch for writing if nothing was written since version.
+ * @param version[IN] a version returned by readLock()
+ * @return true if the latch was taken
+ */
+bool VersionLatch::upgrade(uint64_t version)
+{
+    return word.compare_exchange_strong(version, version + 1, memory_order_acquire);
+}
+
+/*
+ * Release the latch taken by upgrade() and advance the version.
+ */
+void VersionLatch::writeUnlock()
+{
+    word.fetch_add(1, memory_order_release);
+}
+
+/*
+ * Create an empty cache.
+ * @param budget[IN] the most memory the decoded nodes may take
+ */
+NodeCache::NodeCache(size_t budget)
+{
+    bytes = 0;
+    this->budget = budget;
+}
+
+// the memory taken by a decoded node with keyCount keys
+size_t NodeCache::nodeSize(size_t keyCount)
+{
+    return sizeof(Node) + keyCount * sizeof(int) + (keyCount + 1) * sizeof(PageId);
+}
+
+/*
+ * Find the children of a cached node to follow for n keys.
+ * @return false if the node is not cached with the version
+ */
+bool NodeCache::route(PageId pid, uint64_t version, const int* keys, const int* order, int n,
+                      PageId* children, bool* full) const
+{
+    shared_lock<shared_mutex> lock(latch);
+    unordered_map<PageId, Node>::const_iterator it = nodes.find(pid);
+    if (it == nodes.end() || it->second.version != version) {
+        return false;
+    }
+    for (int i = 0; i < n; i++) {
+        children[i] = it->second.child(keys[order ? order[i] : i]);
+    }
+    if (full != NULL) {
+        *full = it->second.full;
+    }
+    return true;
+}
+
+/*
+ * Check whether a node would be cached, before it is decoded.
+ * @return true if there is room for it
+ */
+bool NodeCache::admits(PageId pid, int depth, int keyCount) const
+{
+    shared_lock<shared_mutex> lock(latch);
+    size_t size = nodeSize(keyCount);
+    unordered_map<PageId, Node>::const_iterator it = nodes.find(pid);
+    if (it != nodes.end()) {
+        size_t freed = nodeSize(it->second.keys.size());
+        size = (size > freed) ? size - freed : 0;
+    }
+
+    // the nodes closer to the leaves can make room
+    size_t available = budget - min(bytes, budget);
+    for (int d = 0; d < depth && d < (int)byDepth.size(); d++) {
+        available += depthBytes[d];
+    }
+    return available >= size;
+}
+
+/*
+ * Make room for more bytes by dropping nodes less deep than depth,
+ * those closest to the leaves first.
+ * @return true if there is room
+ */
+bool NodeCache::makeRoom(size_t more, int depth)
+{
+    for (int d = 0; d < depth && d < (int)byDepth.size() && bytes + more > budget; d++) {
+        while (!byDepth[d].empty() && bytes + more > budget) {
+            unordered_map<PageId, Node>::iterator it = nodes.find(byDepth[d].back());
+            size_t size = nodeSize(it->second.keys.size());
+            bytes -= size;
+            depthBytes[d] -= size;
+            nodes.erase(it);
+            byDepth[d].pop_back();
+        }
+    }
+    return bytes + more <= budget;
+}
+
+/*
+ * Cache a decoded node, dropping nodes closer to the leaves if needed.
+ */
+void NodeCache::add(PageId pid, Node&& node)
+{
+    unique_lock<shared_mutex> lock(latch);
+    size_t size = nodeSize(node.keys.size());
+    unordered_map<PageId, Node>::iterator it = nodes.find(pid);
+
+    // a newer version of a cached node replaces it
+    if (it != nodes.end()) {
+        size_t freed = nodeSize(it->second.keys.size());
+        if (it->second.depth != node.depth ||
+            (size > freed && !makeRoom(size - freed, node.depth))) {
+            return;
+        }
+        bytes += size - freed;
+        depthBytes[node.depth] += size - freed;
+        it->second = std::move(node);
+        return;
+    }
+
+    if (!makeRoom(size, node.depth)) {
+        return;
+    }
+    if ((int)byDepth.size() <= node.depth) {
+        byDepth.resize(node.depth + 1);
+        depthBytes.resize(node.depth + 1);
+    }
+    byDepth[node.depth].push_back(pid);
+    bytes += size;
+    depthBytes[node.depth] += size;
+    nodes.emplace(pid, std::move(node));
+}
+
+/*
+ * Drop all nodes.
+ */
+void NodeCache::clear()
+{
+    unique_lock<shared_mutex> lock(latch);
+    nodes.clear();
+    byDepth.clear();
+    depthBytes.clear();
+    bytes = 0;
+}
+
+/*
+ * Return the child of a decoded non-leaf node to follow for searchKey.
+ * @param searchKey[IN] the key being looked up
+ * @return the child node to follow
+ */
+PageId NodeCache::Node::child(int searchKey) const
+{
+    // keys equal to a separator live in its right child
+    return pids[upper_bound(keys.begin(), keys.end(), searchKey) - keys.begin()];
+}
+
+/*
+ * The caches of the index files opened in 'r' mode, kept after the files
+ * are closed. A cache is valid as long as the file has the modification
+ * time and the size it had when the cache was made.
+ */
+struct SharedNodeCache {
+    dev_t    dev;
+    ino_t    ino;
+    struct timespec mtime;
+    off_t    size;
+    shared_ptr<NodeCache> cache;
+    uint64_t lastUse;   /// when the cache was last returned
+};
+
+static mutex sharedCachesLatch;
+static vector<SharedNodeCache> sharedCaches;
+static uint64_t sharedCacheClock = 0;
+
+shared_ptr<NodeCache> NodeCache::forFile(const string& filename, size_t budget)
+{
+    struct stat st;
+    if (::stat(filename.c_str(), &st) < 0) {
+        return make_shared<NodeCache>(budget);
+    }
+
+    lock_guard<mutex> lock(sharedCachesLatch);
+    unsigned i;
+    for (i = 0; i < sharedCaches.size(); i++) {
+        if (sharedCaches[i].dev == st.st_dev && sharedCaches[i].ino == st.st_ino) {
+            break;
+        }
+    }
+
+    // keep the caches of the files used most recently
+    if (i == sharedCaches.size()) {
+        if (sharedCaches.size() < (size_t)MAX_SHARED_FILES) {
+            sharedCaches.resize(i + 1);
+        } else {
+            i = 0;
+            for (unsigned j = 1; j < sharedCaches.size(); j++) {
+                if (sharedCaches[j].lastUse < sharedCaches[i].lastUse) {
+                    i = j;
+                }
+            }
+        }
+        sharedCaches[i].cache.reset();
+    }
+
+    SharedNodeCache& shared = sharedCaches[i];
+    if (!shared.cache || shared.mtime.tv_sec != st.st_mtim.tv_sec ||
+        shared.mtime.tv_nsec != st.st_mtim.tv_nsec || shared.size != st.st_size) {
+        shared.dev = st.st_dev;
+        shared.ino = st.st_ino;
+        shared.mtime = st.st_mtim;
+        shared.size = st.st_size;
+        shared.cache = make_shared<NodeCache>(budget);
+    }
+    shared.lastUse = ++sharedCacheClock;
+    return shared.cache;
+}
+
+void NodeCache::dropFile(const string& filename)
+{
+    struct stat st;
+    if (::stat(filename.c_str(), &st) < 0) {
+        return;
+    }
+
+    lock_guard<mutex> lock(sharedCachesLatch);
+    for (unsigned i = 0; i < sharedCaches.size(); i++) {
+        if (sharedCaches[i].dev == st.st_dev && sharedCaches[i].ino == st.st_ino) {
+            sharedCaches.erase(sharedCaches.begin() + i);
+            return;
+        }
+    }
+}
+
+/*
+ * The memory budget for decoded non-leaf nodes, from the environment.
+ */
+static size_t nodeCacheBudget()
+{
+    const char* s = getenv("BRUINBASE_INDEX_CACHE_KB");
+    if (s != NULL && atoi(s) >= 0) {
+        return (size_t)atoi(s) * 1024;
+    }
+    return (size_t)BTreeIndex::DEFAULT_INDEX_CACHE_KB * 1024;
+}
+
 /*
  * BTreeIndex constructor
  */
 BTreeIndex::BTreeIndex()
 {
     rootPid = -1;
+    treeHeight = 0;
+    keyCount = 0;
+    minKey = 0;
+    maxKey = 0;
+    tableEnd.pid = tableEnd.sid = -1;
+    writable = false;
+    cacheBudget = nodeCacheBudget();
+    bulkFill = 1.0;
+    bulkPack = false;
+    bulkTarget = 1;
+    bulkLeafPid = -1;
+    bulkLastKey = 0;
+}
+
+BTreeIndex::~BTreeIndex()
+{
+    freeLatches();
+}
+
+/*
+ * Return the version latch of a node.
+ * @param pid[IN] a node of the tree
+ * @return the version latch of the node
+ */
+VersionLatch& BTreeIndex::nodeLatch(PageId pid)
+{
+    // nothing changes the nodes of an index opened in 'r' mode.
+    // a negative pid comes from a torn read that is about to be retried.
+    if (!latchChunks || pid < 0) {
+        return fixedLatch;
+    }
+
+    atomic<VersionLatch*>& slot = latchChunks[pid >> LATCH_CHUNK_BITS];
+    VersionLatch* chunk = slot.load(memory_order_acquire);
+    if (chunk == NULL) {
+        VersionLatch* fresh = new VersionLatch[LATCH_CHUNK_SIZE];
+        if (slot.compare_exchange_strong(chunk, fresh)) {
+            chunk = fresh;
+        } else {
+            delete [] fresh;
+        }
+    }
+    return chunk[pid & (LATCH_CHUNK_SIZE - 1)];
+}
+
+/*
+ * Drop the version latches of the nodes.
+ */
+void BTreeIndex::freeLatches()
+{
+    if (latchChunks) {
+        for (int i = 0; i < LATCH_CHUNK_COUNT; i++) {
+            delete [] latchChunks[i].load();
+        }
+        latchChunks.reset();
+    }
 }
 
 /*
@@ -29,6 +470,76 @@ BTreeIndex::BTreeIndex()
  */
 RC BTreeIndex::open(const string& indexname, char mode)
 {
+    RC rc;
+    if ((rc = pf.open(indexname, mode)) < 0) {
+        return rc;
+    }
+    writable = (mode == 'w' || mode == 'W');
+
+    // the nodes cached by earlier readers are of no use once the file
+    // changes, so a writer keeps its own
+    if (writable) {
+        NodeCache::dropFile(indexname);
+        nodeCache = make_shared<NodeCache>(cacheBudget);
+    } else {
+        nodeCache = NodeCache::forFile(indexname, cacheBudget);
+    }
+
+    // only an index opened for writing changes under its readers
+    freeLatches();
+    if (writable) {
+        latchChunks.reset(new atomic<VersionLatch*>[LATCH_CHUNK_COUNT]());
+    }
+
+    // a new index file. reserve page 0 for the metadata.
+    if (pf.endPid() == 0) {
+        rootPid = -1;
+        treeHeight = 0;
+        keyCount = 0;
+        tableEnd.pid = tableEnd.sid = -1;
+        runPid = -1;
+        if (writable && (rc = writeMeta()) < 0) {
+            pf.close();
+            return rc;
+        }
+        return 0;
+    }
+
+    // read the metadata from page 0
+    PageHandle page;
+    if ((rc = pf.fetch(0, page)) < 0) {
+        pf.close();
+        return rc;
+    }
+    BTreeMeta meta;
+    memcpy(&meta, page.data(), sizeof(meta));
+    page.unpin();
+
+    rootPid = meta.rootPid;
+    treeHeight = meta.treeHeight;
+    tableEnd.pid = tableEnd.sid = -1;
+    runPid = -1;
+    if (meta.formatVersion >= 1 && meta.formatVersion <= INDEX_FORMAT_VERSION) {
+        if (meta.pageSize != pf.getPageSize()) {
+            pf.close();
+            return RC_INVALID_FILE_FORMAT;
+        }
+        keyCount = meta.keyCount;
+        minKey = meta.minKey;
+        maxKey = meta.maxKey;
+        if (meta.formatVersion >= 2) {
+            tableEnd = meta.tableEnd;
+        }
+        if (meta.formatVersion >= 3) {
+            runPid = meta.runPid;
+        }
+    } else {
+        // an older file without the key statistics
+        keyCount = (rootPid < 0) ? 0 : -1;
+    }
+
+    // index lookups jump around the file; do not read ahead
+    pf.advise(PageFile::RANDOM);
     return 0;
 }
 
@@ -38,9 +549,107 @@ RC BTreeIndex::open(const string& indexname, char mode)
  */
 RC BTreeIndex::close()
 {
+    RC rc = 0;
+    if (writable) {
+        rc = writeMeta();
+    }
+    RC crc = pf.close();
+    writable = false;
+    nodeCache.reset();
+    freeLatches();
+    return (rc < 0) ? rc : crc;
+}
+
+/*
+ * Store the metadata of the tree in page 0 of the index file.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::writeMeta()
+{
+    RC rc;
+    PageHandle page;
+    if ((rc = pf.fetchNew(0, page)) < 0) {
+        return rc;
+    }
+    BTreeMeta meta;
+    meta.rootPid = rootPid;
+    meta.treeHeight = treeHeight;
+    meta.formatVersion = INDEX_FORMAT_VERSION;
+    meta.pageSize = pf.getPageSize();
+    meta.keyCount = keyCount;
+    meta.minKey = minKey;
+    meta.maxKey = maxKey;
+    meta.tableEnd = tableEnd;
+    meta.runPid = runPid;
+    memset(page.data(), 0, pf.getPageSize());
+    memcpy(page.data(), &meta, sizeof(meta));
+    page.markDirty();
     return 0;
 }
 
+/*
+ * Get a page for a new node at the end of the file.
+ * @param pid[OUT] the page to use
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::allocatePage(PageId& pid)
+{
+    PageHandle page;
+    lock_guard<mutex> lock(metaLatch);
+
+    // extend the file right away, so that a concurrent insert
+    // does not get the same page
+    pid = pf.endPid();
+    return pf.fetchNew(pid, page);
+}
+
+/*
+ * Account for a key added to the index in the key statistics.
+ * @param key[IN] the added key
+ */
+void BTreeIndex::addKey(int key)
+{
+    lock_guard<mutex> lock(metaLatch);
+
+    // the statistics of an older index file are unknown
+    if (keyCount < 0) {
+        return;
+    }
+    if (keyCount == 0 || key < minKey) {
+        minKey = key;
+    }
+    if (keyCount == 0 || key > maxKey) {
+        maxKey = key;
+    }
+    keyCount++;
+}
+
+/*
+ * Record the end of the table covered by the index.
+ * @param end[IN] the endRid() of the table
+ */
+void BTreeIndex::setTableEnd(const RecordId& end)
+{
+    lock_guard<mutex> lock(metaLatch);
+    tableEnd = end;
+}
+
+/*
+ * Return the smallest and the largest key in the index.
+ * @param min[OUT] the smallest key
+ * @param max[OUT] the largest key
+ * @return false if the index is empty or the bounds are not known
+ */
+bool BTreeIndex::getKeyBounds(int& min, int& max) const
+{
+    if (keyCount <= 0) {
+        return false;
+    }
+    min = minKey;
+    max = maxKey;
+    return true;
+}
+
 /*
  * Insert (key, RecordId) pair to the index.
  * @param key[IN] the key for the value inserted into the index
@@ -49,7 +658,236 @@ RC BTreeIndex::close()
  */
 RC BTreeIndex::insert(int key, const RecordId& rid)
 {
-    return 0;
+    RC rc;
+    bool restart;
+
+    // try again until no other thread gets in the way
+    do {
+        restart = false;
+        rc = tryInsert(key, rid, restart);
+    } while (restart);
+
+    if (rc == 0) {
+        addKey(key);
+    }
+    return rc;
+}
+
+/*
+ * Make one attempt to insert (key, rid). The attempt is abandoned and
+ * restart is set if a node on the way changed under it, or after it
+ * split a full non-leaf node on the way down.
+ * @param restart[OUT] true if the insert has to be tried again
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::tryInsert(int key, const RecordId& rid, bool& restart)
+{
+    RC rc;
+
+    uint64_t treeVersion = treeLatch.readLock();
+    PageId pid = rootPid;
+    int height = treeHeight;
+
+    // the first key creates a single leaf as the root
+    if (pid < 0) {
+        if (!treeLatch.upgrade(treeVersion)) {
+            restart = true;
+            return 0;
+        }
+        BTLeafNode leaf(pf.getPageSize());
+        if ((rc = leaf.insert(key, rid)) == 0 && (rc = allocatePage(pid)) == 0 &&
+            (rc = leaf.write(pid, pf)) == 0) {
+            rootPid = pid;
+            treeHeight = 1;
+        }
+        treeLatch.writeUnlock();
+        return rc;
+    }
+
+    // descend with lock coupling: the version of a child is noted before
+    // the version of its parent is checked again, so the child was the
+    // one to follow at that moment. the tree latch is the parent of the root.
+    VersionLatch* parentLatch = &treeLatch;
+    uint64_t parentVersion = treeVersion;
+    PageId parentPid = -1;
+    uint64_t version = nodeLatch(pid).readLock();
+    if (!treeLatch.validate(treeVersion)) {
+        restart = true;
+        return 0;
+    }
+
+    for (int level = 1; level < height; level++) {
+        PageId child = -1;
+        bool full;
+        rc = routeKeys(pid, version, height - level + 1, &key, NULL, 1, &child, &full);
+        uint64_t childVersion = nodeLatch(child).readLock();
+        if (!nodeLatch(pid).validate(version)) {
+            restart = true;
+            return 0;
+        }
+        if (rc < 0) {
+            return rc;
+        }
+
+        // split a full node on the way down, so that a split below it
+        // always finds room in it. then start over.
+        if (full) {
+            if (!parentLatch->upgrade(parentVersion)) {
+                restart = true;
+                return 0;
+            }
+            VersionLatch& latch = nodeLatch(pid);
+            if (!latch.upgrade(version)) {
+                parentLatch->writeUnlock();
+                restart = true;
+                return 0;
+            }
+            BTNonLeafNode node;
+            BTNonLeafNode sibling(pf.getPageSize());
+            PageId siblingPid;
+            int midKey;
+            if ((rc = node.read(pid, pf)) == 0 && (rc = allocatePage(siblingPid)) == 0 &&
+                (rc = node.split(sibling, midKey)) == 0 &&
+                (rc = sibling.write(siblingPid, pf)) == 0 && (rc = node.write(pid, pf)) == 0) {
+                rc = addToParent(parentPid, pid, midKey, siblingPid);
+            }
+            latch.writeUnlock();
+            parentLatch->writeUnlock();
+            restart = (rc == 0);
+            return rc;
+        }
+
+        parentLatch = &nodeLatch(pid);
+        parentVersion = version;
+        parentPid = pid;
+        pid = child;
+        version = childVersion;
+    }
+
+    BTLeafNode leaf;
+    VersionLatch& latch = nodeLatch(pid);
+    if ((rc = leaf.read(pid, pf)) < 0) {
+        restart = !latch.validate(version);
+        return restart ? 0 : rc;
+    }
+
+    // the key is in the leaf already. add rid to its posting list,
+    // which the latch of the leaf protects as well. a changed entry
+    // may not fit in a packed leaf, so a list that moves or a new one
+    // is handled below with the parent locked as well.
+    int eid;
+    int found;
+    RecordId entry;
+    bool duplicate = (leaf.locate(key, eid) == 0 && leaf.readEntry(eid, found, entry) == 0);
+    if (duplicate && (!leaf.isPacked() || postingStays(entry))) {
+        if (!latch.upgrade(version)) {
+            restart = true;
+            return 0;
+        }
+        RecordId list = entry;
+        if ((rc = appendPosting(list, rid)) == 0 && list != entry) {
+            rc = leaf.setEntryRid(eid, list);
+        }
+        if (rc == 0) {
+            rc = leaf.write(pid, pf);
+        }
+        latch.writeUnlock();
+        return rc;
+    }
+
+    // the leaf has room. only the leaf is locked.
+    if (!duplicate && leaf.fits(key, rid)) {
+        if (!latch.upgrade(version)) {
+            restart = true;
+            return 0;
+        }
+        if ((rc = leaf.insert(key, rid)) == 0) {
+            rc = leaf.write(pid, pf);
+        }
+        latch.writeUnlock();
+        return rc;
+    }
+
+    // the leaf is full. lock its parent as well, split the leaf and
+    // link the new sibling into the leaf chain.
+    if (!parentLatch->upgrade(parentVersion)) {
+        restart = true;
+        return 0;
+    }
+    if (!latch.upgrade(version)) {
+        parentLatch->writeUnlock();
+        restart = true;
+        return 0;
+    }
+    BTLeafNode sibling(pf.getPageSize());
+    PageId next = leaf.getNextNodePtr();
+    PageId siblingPid;
+    int siblingKey;
+    if (duplicate) {
+        // the posting list goes into whichever half of the split leaf
+        // holds the entry, where it always fits
+        RecordId list = entry;
+        if ((rc = appendPosting(list, rid)) == 0 && (rc = leaf.setEntryRid(eid, list)) == 0) {
+            rc = leaf.write(pid, pf);
+        }
+        if (rc != RC_NODE_FULL) {
+            latch.writeUnlock();
+            parentLatch->writeUnlock();
+            return rc;
+        }
+        if ((rc = allocatePage(siblingPid)) == 0 && (rc = leaf.split(sibling, siblingKey)) == 0) {
+            int leftCount = leaf.getKeyCount();
+            rc = (eid < leftCount) ? leaf.setEntryRid(eid, list)
+                                   : sibling.setEntryRid(eid - leftCount, list);
+        }
+    } else if ((rc = allocatePage(siblingPid)) == 0) {
+        rc = leaf.insertAndSplit(key, rid, sibling, siblingKey);
+    }
+    if (rc == 0) {
+        sibling.setNextNodePtr(next);
+        leaf.setNextNodePtr(siblingPid);
+        if ((rc = sibling.write(siblingPid, pf)) == 0 && (rc = leaf.write(pid, pf)) == 0) {
+            rc = addToParent(parentPid, pid, siblingKey, siblingPid);
+        }
+    }
+    latch.writeUnlock();
+    parentLatch->writeUnlock();
+    return rc;
+}
+
+/*
+ * Add the new right sibling of a split node to the parent. The caller
+ * holds the latch of the parent, or the tree latch if the split node is
+ * the root, in which case a new root is made.
+ * @param parentPid[IN] the parent. -1 if the split node is the root
+ * @param left[IN] the split node
+ * @param key[IN] the key separating the two nodes
+ * @param right[IN] the new right sibling
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::addToParent(PageId parentPid, PageId left, int key, PageId right)
+{
+    RC rc;
+
+    // the root was split. grow the tree by one level.
+    if (parentPid < 0) {
+        BTNonLeafNode root(pf.getPageSize());
+        PageId pid;
+        root.initializeRoot(left, key, right);
+        if ((rc = allocatePage(pid)) < 0 || (rc = root.write(pid, pf)) < 0) {
+            return rc;
+        }
+        rootPid = pid;
+        treeHeight++;
+        return 0;
+    }
+
+    // full parents were split on the way down, so this one has room
+    BTNonLeafNode parent;
+    if ((rc = parent.read(parentPid, pf)) < 0 || (rc = parent.insert(key, right)) < 0) {
+        return rc;
+    }
+    return parent.write(parentPid, pf);
 }
 
 /**
@@ -72,6 +910,558 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
  */
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
+    RC rc;
+
+    for (;;) {
+        cursor.pid = -1;
+        cursor.eid = 0;
+        cursor.key = searchKey;
+        cursor.version = STALE_VERSION;
+        cursor.listPid = -1;
+        cursor.listEid = 0;
+
+        uint64_t treeVersion = treeLatch.readLock();
+        PageId pid = rootPid;
+        int height = treeHeight;
+        uint64_t version = nodeLatch(pid).readLock();
+        if (!treeLatch.validate(treeVersion)) {
+            continue;
+        }
+        if (pid < 0) {
+            return RC_NO_SUCH_RECORD;
+        }
+
+        // descend to the leaf that may hold searchKey.
+        // start over if a node changed while it was read.
+        int level;
+        for (level = 1; level < height; level++) {
+            PageId child = -1;
+            rc = routeKeys(pid, version, height - level + 1, &searchKey, NULL, 1, &child);
+            uint64_t childVersion = nodeLatch(child).readLock();
+            if (!nodeLatch(pid).validate(version)) {
+                break;
+            }
+            if (rc < 0) {
+                return rc;
+            }
+            pid = child;
+            version = childVersion;
+        }
+        if (level < height) {
+            continue;
+        }
+
+        BTLeafNode leaf;
+        if ((rc = leaf.read(pid, pf)) == 0) {
+            rc = leaf.locate(searchKey, cursor.eid);
+        }
+        if (!nodeLatch(pid).validate(version)) {
+            continue;
+        }
+        if (rc == 0 || rc == RC_NO_SUCH_RECORD) {
+            cursor.pid = pid;
+            cursor.version = version;
+        }
+        return rc;
+    }
+}
+
+/*
+ * Find the children of the non-leaf node pid to follow for n keys,
+ * using the decoded copy of the node if it is cached. A node read from
+ * the PageFile is cached if the budget allows.
+ * @param pid[IN] the non-leaf node
+ * @param version[IN] the version of the node noted by the caller
+ * @param depth[IN] the # of levels from the node to the leaves
+ * @param keys[IN] the keys being looked up
+ * @param order[IN] the indexes of the keys to route. NULL for all n
+ * @param n[IN] the # of keys to route
+ * @param children[OUT] the child node to follow for each key
+ * @param full[OUT] if not NULL, set to true if the node is full
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::routeKeys(PageId pid, uint64_t version, int depth, const int* keys,
+                         const int* order, int n, PageId* children, bool* full)
+{
+    if (nodeCache->route(pid, version, keys, order, n, children, full)) {
+        return 0;
+    }
+
+    RC rc;
+    BTNonLeafNode node;
+    if ((rc = node.read(pid, pf)) < 0) {
+        return rc;
+    }
+    for (int i = 0; i < n; i++) {
+        node.locateChildPtr(keys[order ? order[i] : i], children[i]);
+    }
+    if (full != NULL) {
+        *full = (node.getKeyCount() >= node.getMaxKeyCount());
+    }
+    cacheNode(pid, version, depth, node);
+    return 0;
+}
+
+/*
+ * Keep a decoded copy of a non-leaf node read from the PageFile,
+ * if it fits in the budget and did not change while it was decoded.
+ * @param pid[IN] the non-leaf node
+ * @param version[IN] the version of the node noted before reading it
+ * @param depth[IN] the # of levels from the node to the leaves
+ * @param node[IN] the node
+ */
+void BTreeIndex::cacheNode(PageId pid, uint64_t version, int depth, BTNonLeafNode& node)
+{
+    // check the budget before spending time on decoding
+    int keyCount = node.getKeyCount();
+    if (keyCount == 0 || !nodeCache->admits(pid, depth, keyCount)) {
+        return;
+    }
+
+    NodeCache::Node decoded;
+    decoded.version = version;
+    decoded.depth = depth;
+    decoded.full = (keyCount >= node.getMaxKeyCount());
+    decoded.keys.resize(keyCount);
+    decoded.pids.resize(keyCount + 1);
+    for (int i = 0; i < keyCount; i++) {
+        node.readPidKey(i, decoded.pids[i], decoded.keys[i]);
+    }
+    int key;
+    node.readKeyPid(keyCount - 1, key, decoded.pids[keyCount]);
+
+    // a node changed while it was decoded may be torn
+    if (!nodeLatch(pid).validate(version)) {
+        return;
+    }
+    nodeCache->add(pid, std::move(decoded));
+}
+
+/*
+ * Run locate() for many keys at once, walking the tree once for all keys.
+ * @param keys[IN] the keys to find, in any order
+ * @param n[IN] the # of keys
+ * @param out[OUT] the cursors for the keys
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::locateBatch(const int* keys, int n, IndexCursor* out)
+{
+    for (int i = 0; i < n; i++) {
+        out[i].pid = -1;
+        out[i].eid = 0;
+        out[i].key = keys[i];
+        out[i].version = STALE_VERSION;
+        out[i].listPid = -1;
+        out[i].listEid = 0;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+
+    // visit the keys in key order, so that the keys routed through
+    // the same node are adjacent
+    vector<int> order(n);
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(),
+                [keys](int a, int b) { return keys[a] < keys[b]; });
+
+    uint64_t treeVersion = treeLatch.readLock();
+    PageId pid = rootPid;
+    int height = treeHeight;
+    uint64_t version = nodeLatch(pid).readLock();
+    if (!treeLatch.validate(treeVersion)) {
+        return locateEach(keys, order.data(), n, out);
+    }
+    if (pid < 0) {
+        return 0;
+    }
+    return locateBatchIn(pid, version, height, keys, order.data(), n, out);
+}
+
+/*
+ * Run locate() once for each key of a batch whose path changed while
+ * locateBatch() walked it.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::locateEach(const int* keys, const int* order, int n, IndexCursor* out)
+{
+    RC rc;
+    for (int i = 0; i < n; i++) {
+        rc = locate(keys[order[i]], out[order[i]]);
+        if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Run locateBatch() on the subtree rooted at pid.
+ * @param pid[IN] the root of the subtree
+ * @param version[IN] the version of pid noted while reaching it
+ * @param depth[IN] the # of levels from pid down to the leaves. 1 for a leaf
+ * @param keys[IN] all keys of the batch
+ * @param order[IN] the indexes of the keys routed to pid, in key order
+ * @param n[IN] the # of entries in order
+ * @param out[OUT] the cursors for all keys of the batch
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::locateBatchIn(PageId pid, uint64_t version, int depth, const int* keys,
+                             const int* order, int n, IndexCursor* out)
+{
+    RC rc;
+
+    // the keys of a node that changed under the batch are looked up one
+    // by one, since some of them may now belong to another node
+    if (depth == 1) {
+        BTLeafNode leaf;
+        rc = leaf.read(pid, pf);
+        for (int i = 0; rc == 0 && i < n; i++) {
+            IndexCursor& cursor = out[order[i]];
+            cursor.pid = pid;
+            cursor.version = version;
+            leaf.locate(keys[order[i]], cursor.eid);
+        }
+        if (!nodeLatch(pid).validate(version)) {
+            return locateEach(keys, order, n, out);
+        }
+        return rc;
+    }
+
+    // route every key to a child, and note the versions of the children
+    // before checking that the node did not change
+    vector<PageId> children(n, -1);
+    vector<uint64_t> versions(n);
+    rc = routeKeys(pid, version, depth, keys, order, n, children.data());
+    for (int i = 0; rc == 0 && i < n; i++) {
+        versions[i] = (i > 0 && children[i] == children[i - 1])
+                      ? versions[i - 1] : nodeLatch(children[i]).readLock();
+    }
+    if (!nodeLatch(pid).validate(version)) {
+        return locateEach(keys, order, n, out);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    // the children are leaves. have them all read ahead, one request per
+    // run of consecutive pages, before visiting the first one.
+    if (depth == 2) {
+        int i = 0;
+        while (i < n) {
+            PageId last = children[i];
+            int j = i + 1;
+            while (j < n && (children[j] == last || children[j] == last + 1)) {
+                last = children[j];
+                j++;
+            }
+            pf.prefetch(children[i], last - children[i] + 1);
+            i = j;
+        }
+    }
+
+    // visit each child once with the keys routed to it
+    int i = 0;
+    while (i < n) {
+        int j = i + 1;
+        while (j < n && children[j] == children[i]) {
+            j++;
+        }
+        if ((rc = locateBatchIn(children[i], versions[i], depth - 1, keys, order + i, j - i,
+                                out)) < 0) {
+            return rc;
+        }
+        i = j;
+    }
+    return 0;
+}
+
+/*
+ * Add rid to the records of a key, turning its leaf entry into a posting
+ * list if it held a single RecordId. The caller holds the latch of the
+ * leaf and stores a changed entry in the leaf afterwards.
+ * @param entry[IN/OUT] the RecordId of the leaf entry of the key
+ * @param rid[IN] the RecordId to add
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::appendPosting(RecordId& entry, const RecordId& rid)
+{
+    RC rc;
+    int pageSize = pf.getPageSize();
+
+    // the second record of a key starts a run with both
+    if (entry.sid >= 0) {
+        RecordId rids[2] = { entry, rid };
+        return newRun(rids, 2, 2, entry);
+    }
+    if (entry.sid == POSTING_SID) {
+        return appendChain(entry.pid, rid);
+    }
+
+    // add to the run if it has room. the run belongs to the key alone,
+    // so the latch of the leaf protects it.
+    PageHandle page;
+    int count, capacity;
+    char* run;
+    if ((rc = pf.fetch(entry.pid, page)) < 0) {
+        return rc;
+    }
+    if ((run = findRun(page.data(), pageSize, RUN_SLOT(entry.sid), count, capacity)) == NULL) {
+        return RC_INVALID_FILE_FORMAT;
+    }
+    if (count < capacity) {
+        memcpy(RUN_RID(run, count), &rid, sizeof(RecordId));
+        setField(run, RUN_COUNT, count + 1);
+        page.markDirty();
+        return 0;
+    }
+
+    // the run is full. move the list to a run twice as large,
+    // or to a chain of its own once it outgrows the largest run.
+    vector<RecordId> rids(count + 1);
+    memcpy(rids.data(), RUN_RID(run, 0), count * sizeof(RecordId));
+    rids[count] = rid;
+    page.unpin();
+    if (capacity < MAX_RUN_SIZE(pageSize)) {
+        return newRun(rids.data(), count + 1, min(2 * capacity, MAX_RUN_SIZE(pageSize)), entry);
+    }
+    return newChain(rids.data(), count + 1, entry);
+}
+
+/*
+ * Check whether appendPosting() can add a RecordId to a posting list
+ * without changing the leaf entry of the key.
+ * @param entry[IN] the RecordId of the leaf entry of the key
+ * @return true if the entry stays the same
+ */
+bool BTreeIndex::postingStays(const RecordId& entry)
+{
+    if (entry.sid >= 0) {
+        return false;
+    }
+    if (entry.sid == POSTING_SID) {
+        return true;
+    }
+
+    // a run stays while it has room. an unreadable run is left to
+    // appendPosting() to report.
+    PageHandle page;
+    int count, capacity;
+    return pf.fetch(entry.pid, page) == 0 &&
+           findRun(page.data(), pf.getPageSize(), RUN_SLOT(entry.sid), count, capacity) != NULL &&
+           count < capacity;
+}
+
+/*
+ * Copy the RecordIds of a posting list into a new run of a shared
+ * posting page, taking a new shared page if the current one is full.
+ * @param rids[IN] the RecordIds of the list
+ * @param count[IN] the # of RecordIds
+ * @param capacity[IN] the # of RecordIds the run can hold
+ * @param entry[OUT] the leaf entry referring to the run
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::newRun(const RecordId* rids, int count, int capacity, RecordId& entry)
+{
+    RC rc;
+    PageHandle page;
+    int pageSize = pf.getPageSize();
+    lock_guard<mutex> lock(runLatch);
+
+    // the run and its slot must fit between the slots and the runs
+    int slots = 0;
+    int start = pageSize;
+    if (runPid >= 0) {
+        if ((rc = pf.fetch(runPid, page)) < 0) {
+            return rc;
+        }
+        slots = getField(page.data(), SHARED_SLOTS);
+        start = getField(page.data(), SHARED_START);
+    }
+    if (runPid < 0 || start - RUN_SIZE(capacity) < (int)SHARED_SLOT(slots + 1)) {
+        PageId pid;
+        if ((rc = allocatePage(pid)) < 0 || (rc = pf.fetchNew(pid, page)) < 0) {
+            return rc;
+        }
+        memset(page.data(), 0, pageSize);
+        runPid = pid;
+        slots = 0;
+        start = pageSize;
+    }
+
+    // the run is written before the leaf entry refers to it
+    char* run = page.data() + start - RUN_SIZE(capacity);
+    setField(run, RUN_COUNT, count);
+    setField(run, RUN_CAPACITY, capacity);
+    memcpy(RUN_RID(run, 0), rids, count * sizeof(RecordId));
+    setField(page.data(), SHARED_SLOT(slots), start - RUN_SIZE(capacity));
+    setField(page.data(), SHARED_START, start - RUN_SIZE(capacity));
+    setField(page.data(), SHARED_SLOTS, slots + 1);
+    page.markDirty();
+
+    entry.pid = runPid;
+    entry.sid = RUN_SID(slots);
+    return 0;
+}
+
+/*
+ * Copy the RecordIds of a posting list into a new posting page, which
+ * starts a chain of its own.
+ * @param rids[IN] the RecordIds of the list. they fit in one page
+ * @param count[IN] the # of RecordIds
+ * @param entry[OUT] the leaf entry referring to the chain
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::newChain(const RecordId* rids, int count, RecordId& entry)
+{
+    RC rc;
+    PageId pid;
+    PageHandle page;
+
+    if ((rc = allocatePage(pid)) < 0 || (rc = pf.fetchNew(pid, page)) < 0) {
+        return rc;
+    }
+    memset(page.data(), 0, pf.getPageSize());
+    setField(page.data(), POSTING_COUNT, count);
+    setField(page.data(), POSTING_NEXT, -1);
+    setField(page.data(), POSTING_TAIL, pid);
+    setField(page.data(), POSTING_TOTAL, count);
+    memcpy(POSTING_RID(page.data(), 0), rids, count * sizeof(RecordId));
+    page.markDirty();
+
+    entry.pid = pid;
+    entry.sid = POSTING_SID;
+    return 0;
+}
+
+/*
+ * Add rid at the end of the chain of posting pages starting at headPid.
+ * @param headPid[IN] the first posting page of the chain
+ * @param rid[IN] the RecordId to add
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::appendChain(PageId headPid, const RecordId& rid)
+{
+    RC rc;
+    PageId pid;
+    PageHandle page;
+    int pageSize = pf.getPageSize();
+
+    // append to the last page of the chain. the head and the tail may be
+    // the same page, so the header fields are updated one by one.
+    PageHandle head;
+    PageHandle tail;
+    if ((rc = pf.fetch(headPid, head)) < 0 ||
+        (rc = pf.fetch(getField(head.data(), POSTING_TAIL), tail)) < 0) {
+        return rc;
+    }
+
+    // the last page is full. chain a new last page behind it.
+    if (getField(tail.data(), POSTING_COUNT) >= POSTING_CAPACITY(pageSize)) {
+        if ((rc = allocatePage(pid)) < 0 || (rc = pf.fetchNew(pid, page)) < 0) {
+            return rc;
+        }
+        memset(page.data(), 0, pageSize);
+        setField(page.data(), POSTING_NEXT, -1);
+        setField(tail.data(), POSTING_NEXT, pid);
+        tail.markDirty();
+        setField(head.data(), POSTING_TAIL, pid);
+        tail = std::move(page);
+    }
+
+    int count = getField(tail.data(), POSTING_COUNT);
+    memcpy(POSTING_RID(tail.data(), count), &rid, sizeof(RecordId));
+    setField(tail.data(), POSTING_COUNT, count + 1);
+    tail.markDirty();
+    setField(head.data(), POSTING_TOTAL, getField(head.data(), POSTING_TOTAL) + 1);
+    head.markDirty();
+    return 0;
+}
+
+/*
+ * Read the RecordId at the cursor position in a posting list and move
+ * the cursor forward. The caller checks the leaf version afterwards.
+ * @param entry[IN] the RecordId of the leaf entry of the key
+ * @param listPid[IN/OUT] the posting page to read. -1 inside a run
+ * @param listEid[IN/OUT] the entry to read in the posting page or run
+ * @param rid[OUT] the RecordId read
+ * @param found[OUT] false if the list has no RecordId left
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readPosting(const RecordId& entry, PageId& listPid, int& listEid,
+                           RecordId& rid, bool& found)
+{
+    RC rc;
+    PageHandle page;
+    int pageSize = pf.getPageSize();
+    int capacity = POSTING_CAPACITY(pageSize);
+
+    found = false;
+    if (listPid < 0 && entry.sid != POSTING_SID) {
+        int count;
+        char* run;
+        if ((rc = pf.fetch(entry.pid, page)) < 0) {
+            return rc;
+        }
+        run = findRun(page.data(), pageSize, RUN_SLOT(entry.sid), count, capacity);
+        if (run != NULL && listEid < count) {
+            memcpy(&rid, RUN_RID(run, listEid), sizeof(RecordId));
+            listEid++;
+            found = true;
+        }
+        return 0;
+    }
+
+    // a chain holds the RecordIds of a run that it replaced in its first
+    // page, so the entry reached in the run is the entry in that page
+    if (listPid < 0) {
+        listPid = entry.pid;
+    }
+    while (listPid >= 0) {
+        if ((rc = pf.fetch(listPid, page)) < 0) {
+            return rc;
+        }
+        // a torn count is kept within the page; the caller retries anyway
+        int count = min(getField(page.data(), POSTING_COUNT), capacity);
+        if (listEid < count) {
+            memcpy(&rid, POSTING_RID(page.data(), listEid), sizeof(RecordId));
+            listEid++;
+            found = true;
+            return 0;
+        }
+        PageId next = getField(page.data(), POSTING_NEXT);
+        if (next < 0) {
+            return 0;
+        }
+        listPid = next;
+        listEid = 0;
+    }
+    return 0;
+}
+
+/*
+ * Return the # of RecordIds in a posting list.
+ * @param entry[IN] the RecordId of the leaf entry of the key
+ * @param total[OUT] the # of RecordIds
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::postingCount(const RecordId& entry, int& total)
+{
+    RC rc;
+    PageHandle page;
+    if ((rc = pf.fetch(entry.pid, page)) < 0) {
+        return rc;
+    }
+    if (entry.sid == POSTING_SID) {
+        total = max(getField(page.data(), POSTING_TOTAL), 0);
+    } else {
+        int capacity;
+        if (findRun(page.data(), pf.getPageSize(), RUN_SLOT(entry.sid), total, capacity) == NULL) {
+            total = 0;
+        }
+    }
     return 0;
 }
 
@@ -85,5 +1475,612 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
+    RC rc;
+    bool found;
+    bool restart;
+
+    // pid 0 holds the index metadata, so it never is a leaf.
+    // a zero or negative next-node pointer marks the last leaf.
+    while (cursor.pid > 0) {
+        found = restart = false;
+        rc = tryReadForward(cursor, key, rid, found, restart);
+        if (!restart && (rc < 0 || found)) {
+            return rc;
+        }
+    }
+    return RC_END_OF_TREE;
+}
+
+/*
+ * Read one entry at the cursor or move the cursor to the next leaf.
+ * @param found[OUT] true if an entry was read
+ * @param restart[OUT] true if the leaf changed while it was read
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::tryReadForward(IndexCursor& cursor, int& key, RecordId& rid,
+                              bool& found, bool& restart)
+{
+    RC rc;
+    BTLeafNode leaf;
+    VersionLatch& latch = nodeLatch(cursor.pid);
+    uint64_t version = latch.readLock();
+
+    int eid = cursor.eid;
+    PageId next = -1;
+    PageId listPid = cursor.listPid;
+    int listEid = cursor.listEid;
+    bool inList = false;
+    bool listDone = false;
+    if ((rc = leaf.read(cursor.pid, pf)) == 0) {
+        // the leaf changed since the cursor got its place. find it again.
+        // inside a posting list, the key is found again and the place in
+        // the list stays, since RecordIds are only appended to a list.
+        if (version != cursor.version) {
+            leaf.locate(cursor.key, eid);
+        }
+        if (eid < leaf.getKeyCount()) {
+            leaf.readEntry(eid, key, rid);
+            if (rid.sid < 0) {
+                RecordId list = rid;
+                inList = true;
+                rc = readPosting(list, listPid, listEid, rid, found);
+                listDone = (rc == 0 && !found);
+            } else {
+                found = true;
+            }
+        } else {
+            next = leaf.getNextNodePtr();
+        }
+    }
+    if (!latch.validate(version)) {
+        found = false;
+        restart = true;
+        return 0;
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    cursor.version = version;
+    if (found && inList) {
+        // stay on the key until its posting list is read to the end
+        cursor.eid = eid;
+        cursor.key = key;
+        cursor.listPid = listPid;
+        cursor.listEid = listEid;
+    } else if (found || listDone) {
+        cursor.eid = eid + 1;
+        cursor.listPid = -1;
+        cursor.listEid = 0;
+        if (key == INT_MAX) {
+            cursor.pid = -1;  // no larger key can follow
+        } else {
+            cursor.key = key + 1;
+        }
+    } else {
+        // past the last entry of the leaf. move to the next leaf.
+        cursor.pid = next;
+        cursor.eid = 0;
+        cursor.version = STALE_VERSION;
+    }
+    return 0;
+}
+
+/*
+ * Read the keys from the cursor location to the end of its leaf node,
+ * stopping at the first key larger than hi, and move the cursor to the
+ * next leaf through the next-node pointer.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param hi[IN] the largest key to read
+ * @param keys[OUT] the keys read, in ascending order
+ * @return error code. RC_END_OF_TREE if there is no key <= hi left
+ */
+RC BTreeIndex::readLeafKeys(IndexCursor& cursor, int hi, std::vector<int>& keys)
+{
+    return readLeaf(cursor, hi, keys, NULL);
+}
+
+/*
+ * Read the (key, rid) pairs from the cursor location to the end of its
+ * leaf node like readLeafKeys(), along with their RecordIds.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param hi[IN] the largest key to read
+ * @param keys[OUT] the keys read, in ascending order
+ * @param rids[OUT] rids[i] is the RecordId of keys[i]
+ * @return error code. RC_END_OF_TREE if there is no key <= hi left
+ */
+RC BTreeIndex::readLeafEntries(IndexCursor& cursor, int hi, std::vector<int>& keys,
+                               std::vector<RecordId>& rids)
+{
+    return readLeaf(cursor, hi, keys, &rids);
+}
+
+/*
+ * Read the leaf entries for readLeafKeys() and readLeafEntries().
+ * @param rids[OUT] the RecordIds of the keys. NULL if not needed
+ */
+RC BTreeIndex::readLeaf(IndexCursor& cursor, int hi, std::vector<int>& keys,
+                        std::vector<RecordId>* rids)
+{
+    RC rc;
+    BTLeafNode leaf;
+    vector<pair<size_t, RecordId> > lists;  // (position in keys, posting list)
+
+    keys.clear();
+    if (rids != NULL) {
+        rids->clear();
+    }
+    while (cursor.pid > 0) {
+        VersionLatch& latch = nodeLatch(cursor.pid);
+        uint64_t version = latch.readLock();
+        if ((rc = leaf.read(cursor.pid, pf)) < 0) {
+            if (latch.validate(version)) {
+                return rc;
+            }
+            continue;
+        }
+
+        // the leaf changed since the cursor got its place. find it again.
+        int eid = cursor.eid;
+        if (version != cursor.version) {
+            leaf.locate(cursor.key, eid);
+        }
+
+        int keyCount = leaf.getKeyCount();
+        int key;
+        RecordId rid;
+        bool end = false;
+        lists.clear();
+        for (; eid < keyCount; eid++) {
+            leaf.readEntry(eid, key, rid);
+            if (key > hi) {
+                end = true;
+                break;
+            }
+            if (rid.sid < 0) {
+                lists.push_back(make_pair(keys.size(), rid));
+            }
+            keys.push_back(key);
+            if (rids != NULL) {
+                rids->push_back(rid);
+            }
+        }
+        PageId next = leaf.getNextNodePtr();
+        if (!latch.validate(version)) {
+            keys.clear();
+            if (rids != NULL) {
+                rids->clear();
+            }
+            continue;
+        }
+
+        // a duplicate key is read once for each of its records. the
+        // posting lists are trusted only after the leaf is validated.
+        if (!lists.empty()) {
+            vector<int> expanded;
+            vector<RecordId> expandedRids;
+            size_t from = 0;
+            for (unsigned i = 0; i < lists.size(); i++) {
+                size_t at = lists[i].first;
+                int total;
+                expanded.insert(expanded.end(), keys.begin() + from, keys.begin() + at);
+                if (rids == NULL) {
+                    if ((rc = postingCount(lists[i].second, total)) < 0) {
+                        return rc;
+                    }
+                } else {
+                    expandedRids.insert(expandedRids.end(), rids->begin() + from,
+                                        rids->begin() + at);
+                    PageId listPid = -1;
+                    int listEid = 0;
+                    RecordId listRid;
+                    bool found;
+                    size_t before = expandedRids.size();
+                    while ((rc = readPosting(lists[i].second, listPid, listEid, listRid,
+                                             found)) == 0 && found) {
+                        expandedRids.push_back(listRid);
+                    }
+                    if (rc < 0) {
+                        return rc;
+                    }
+                    total = (int)(expandedRids.size() - before);
+                }
+                expanded.insert(expanded.end(), total, keys[at]);
+                from = at + 1;
+            }
+            expanded.insert(expanded.end(), keys.begin() + from, keys.end());
+            keys.swap(expanded);
+            if (rids != NULL) {
+                expandedRids.insert(expandedRids.end(), rids->begin() + from, rids->end());
+                rids->swap(expandedRids);
+            }
+        }
+
+        if (end) {
+            // no more keys in range. leave the cursor at the end.
+            cursor.pid = -1;
+            cursor.eid = 0;
+            return keys.empty() ? RC_END_OF_TREE : 0;
+        }
+
+        if (!keys.empty()) {
+            if (keys.back() == INT_MAX) {
+                next = -1;  // no larger key can follow
+            } else {
+                cursor.key = keys.back() + 1;
+            }
+        }
+        cursor.pid = next;
+        cursor.eid = 0;
+        cursor.version = STALE_VERSION;
+        if (!keys.empty()) {
+            return 0;
+        }
+    }
+    return RC_END_OF_TREE;
+}
+
+/*
+ * Have the operating system read ahead the leaves holding the keys
+ * from lo up to hi, at most count of them, without waiting for them.
+ * @param lo[IN/OUT] the smallest key. set to the smallest key the
+ *                   leaves after the ones read ahead may hold
+ * @param hi[IN] the largest key
+ * @param count[IN/OUT] the most leaves to read ahead. set to the #
+ *                      of leaves read ahead
+ * @return error code. RC_END_OF_TREE if no leaf of the range is left
+ *         after the ones read ahead
+ */
+RC BTreeIndex::prefetchLeaves(int& lo, int hi, int& count)
+{
+    RC rc;
+    int most = count;
+    vector<PageId> leaves;
+
+    count = 0;
+    if (lo > hi || most <= 0) {
+        return (lo > hi) ? RC_END_OF_TREE : 0;
+    }
+
+    for (;;) {
+        uint64_t treeVersion = treeLatch.readLock();
+        PageId pid = rootPid;
+        int height = treeHeight;
+        uint64_t version = nodeLatch(pid).readLock();
+        if (!treeLatch.validate(treeVersion)) {
+            continue;
+        }
+        // a tree of a single leaf has nothing to read ahead
+        if (pid < 0 || height < 2) {
+            return RC_END_OF_TREE;
+        }
+
+        // descend to the parent of the leaf holding lo. fence is the
+        // separator right of the path, the smallest key of the leaves
+        // beyond the subtree of the parent.
+        BTNonLeafNode node;
+        bool hasFence = false;
+        int fence = INT_MAX;
+        int level;
+        int eid = 0;
+        for (level = 1; ; level++) {
+            if ((rc = node.read(pid, pf)) < 0) {
+                break;
+            }
+            int key;
+            PageId child;
+            eid = (node.locate(lo, eid) == 0) ? eid + 1 : eid;
+            if (level == height - 1) {
+                break;
+            }
+            if (eid < node.getKeyCount() && node.readPidKey(eid, child, key) == 0 &&
+                (!hasFence || key < fence)) {
+                hasFence = true;
+                fence = key;
+            }
+            node.locateChildPtr(lo, child);
+            uint64_t childVersion = nodeLatch(child).readLock();
+            if (!nodeLatch(pid).validate(version)) {
+                break;
+            }
+            pid = child;
+            version = childVersion;
+        }
+        if (level < height - 1 || rc < 0) {
+            if (rc < 0 && nodeLatch(pid).validate(version)) {
+                return rc;
+            }
+            continue;
+        }
+
+        // the children of the parent from the leaf holding lo on, up to
+        // the first one beyond hi
+        leaves.clear();
+        int keyCount = node.getKeyCount();
+        int next = lo;
+        bool beyond = false;
+        for (; eid <= keyCount && (int)leaves.size() < most; eid++) {
+            int key;
+            PageId child;
+            if (eid > 0) {
+                node.readKeyPid(eid - 1, key, child);
+                if (key > hi) {
+                    beyond = true;
+                    break;
+                }
+            } else {
+                node.readPidKey(0, child, key);
+            }
+            leaves.push_back(child);
+        }
+
+        // the next leaf starts at its separator, or at the fence if the
+        // parent has no child left
+        bool more = !beyond;
+        if (more && eid <= keyCount) {
+            PageId child;
+            node.readKeyPid(eid - 1, next, child);
+        } else if (more && hasFence) {
+            next = fence;
+        } else {
+            more = false;
+        }
+        if (!nodeLatch(pid).validate(version)) {
+            continue;
+        }
+        if (more && next > hi) {
+            more = false;
+        }
+
+        // one request for each run of consecutive pages
+        unsigned i = 0;
+        while (i < leaves.size()) {
+            unsigned j = i + 1;
+            while (j < leaves.size() && leaves[j] == leaves[j - 1] + 1) {
+                j++;
+            }
+            pf.prefetch(leaves[i], leaves[j - 1] - leaves[i] + 1);
+            i = j;
+        }
+        count = leaves.size();
+        lo = next;
+        return more ? 0 : RC_END_OF_TREE;
+    }
+}
+
+IndexScan::IndexScan(BTreeIndex& index, int lo, int hi, int readAhead)
+    : index(index)
+{
+    this->lo = lo;
+    this->hi = hi;
+    this->readAhead = (readAhead > 0) ? readAhead : 0;
+    started = false;
+    pending = 0;
+    aheadKey = lo;
+    aheadDone = (readAhead <= 0);
+}
+
+/*
+ * Read the next batch of (key, RecordId) pairs in ascending key order.
+ * @param keys[OUT] the keys read
+ * @param rids[OUT] rids[i] is the RecordId of keys[i]
+ * @return error code. RC_END_OF_TREE if no pair of the range is left
+ */
+RC IndexScan::next(std::vector<int>& keys, std::vector<RecordId>& rids)
+{
+    RC rc;
+
+    if (!started) {
+        started = true;
+        if (lo > hi) {
+            cursor.pid = -1;
+        } else if ((rc = index.locate(lo, cursor)) < 0 && rc != RC_NO_SUCH_RECORD) {
+            return rc;
+        }
+    }
+
+    // top up the leaves read ahead once half of them were read
+    if (!aheadDone && pending <= readAhead / 2) {
+        int count = readAhead - pending;
+        rc = index.prefetchLeaves(aheadKey, hi, count);
+        if (rc < 0 && rc != RC_END_OF_TREE) {
+            return rc;
+        }
+        aheadDone = (rc == RC_END_OF_TREE);
+        pending += count;
+    }
+
+    rc = index.readLeafEntries(cursor, hi, keys, rids);
+    if (pending > 0) {
+        pending--;
+    }
+    return rc;
+}
+
+/*
+ * Start building an empty index bottom-up from (key, RecordId) pairs
+ * given in ascending key order by bulkLoadAppend().
+ * @param fillFactor[IN] the fraction of each node to fill (0, 1]
+ * @return error code. RC_INDEX_NOT_EMPTY if the index already has keys
+ */
+RC BTreeIndex::bulkLoadBegin(double fillFactor, bool packLeaves)
+{
+    if (!writable) {
+        return RC_INVALID_FILE_MODE;
+    }
+    if (rootPid >= 0) {
+        return RC_INDEX_NOT_EMPTY;
+    }
+    bulkFill = (fillFactor > 0 && fillFactor <= 1) ? fillFactor : 1.0;
+    bulkPack = packLeaves;
+    bulkTarget = (int)(bulkFill * (packLeaves ? BTLeafNode::getMaxPackedKeyCount(pf.getPageSize())
+                                              : BTLeafNode(pf.getPageSize()).getMaxKeyCount()));
+    if (bulkTarget < 1) {
+        bulkTarget = 1;
+    }
+    bulkLeafPid = -1;
+    bulkKeys.clear();
+    bulkRids.clear();
+    bulkLeaves.clear();
+    nodeCache->clear();
+    return 0;
+}
+
+/*
+ * Write the leaf being bulk loaded and start a new one.
+ * @param key[IN] the first key of the new leaf
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoadLeaf(int key)
+{
+    RC rc;
+    PageId pid;
+
+    if ((rc = allocatePage(pid)) < 0) {
+        return rc;
+    }
+    if (bulkLeafPid >= 0) {
+        BTLeafNode leaf(pf.getPageSize());
+        leaf.setNextNodePtr(pid);
+        if ((rc = leaf.build(bulkKeys.data(), bulkRids.data(), bulkKeys.size(), bulkPack)) < 0 ||
+            (rc = leaf.write(bulkLeafPid, pf)) < 0) {
+            return rc;
+        }
+    }
+    bulkLeafPid = pid;
+    bulkLeaves.push_back(make_pair(key, pid));
+    bulkKeys.clear();
+    bulkRids.clear();
+    bulkRanges = LeafRanges();
+    return 0;
+}
+
+/*
+ * Add the next (key, RecordId) pair of a bulk load.
+ * @param key[IN] the key. it must be larger than the previous key
+ * @param rid[IN] the RecordId for the record with the key
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoadAppend(int key, const RecordId& rid)
+{
+    RC rc;
+    int pageSize = pf.getPageSize();
+
+    if (bulkLeafPid >= 0 && key < bulkLastKey) {
+        return RC_INVALID_RID;
+    }
+
+    // the previous key again. it is the last entry of the current leaf.
+    if (bulkLeafPid >= 0 && key == bulkLastKey) {
+        RecordId entry = bulkRids.back();
+        if ((rc = appendPosting(entry, rid)) < 0) {
+            return rc;
+        }
+        bulkRids.back() = entry;
+        bulkRanges.add(key, entry);
+
+        // the posting list may not fit in a packed leaf. it moves to a new one.
+        if (bulkPack && bulkKeys.size() > 1 &&
+            bulkRanges.packedSize(bulkKeys.size()) > pageSize) {
+            bulkKeys.pop_back();
+            bulkRids.pop_back();
+            if ((rc = bulkLoadLeaf(key)) < 0) {
+                return rc;
+            }
+            bulkKeys.push_back(key);
+            bulkRids.push_back(entry);
+            bulkRanges.add(key, entry);
+        }
+        addKey(key);
+        return 0;
+    }
+
+    // start a new leaf when the current one is filled to the target.
+    // a packed leaf is also filled to the fill factor of its page.
+    bool full = ((int)bulkKeys.size() >= bulkTarget);
+    if (bulkPack && !full && !bulkKeys.empty()) {
+        LeafRanges ranges = bulkRanges;
+        ranges.add(key, rid);
+        full = (ranges.packedSize(bulkKeys.size() + 1) > bulkFill * pageSize);
+    }
+
+    if (bulkLeafPid < 0 || full) {
+        if ((rc = bulkLoadLeaf(key)) < 0) {
+            return rc;
+        }
+    }
+
+    bulkKeys.push_back(key);
+    bulkRids.push_back(rid);
+    bulkRanges.add(key, rid);
+    bulkLastKey = key;
+    addKey(key);
+    return 0;
+}
+
+/*
+ * Finish a bulk load by writing the last leaf and the non-leaf levels.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoadEnd()
+{
+    RC rc;
+
+    if (bulkLeafPid < 0) {
+        return 0;
+    }
+    BTLeafNode leaf(pf.getPageSize());
+    if ((rc = leaf.build(bulkKeys.data(), bulkRids.data(), bulkKeys.size(), bulkPack)) < 0 ||
+        (rc = leaf.write(bulkLeafPid, pf)) < 0) {
+        return rc;
+    }
+    bulkLeafPid = -1;
+    bulkKeys.clear();
+    bulkRids.clear();
+
+    // build the tree level by level. level holds the (smallest key, pid)
+    // of every node of the level below, in key order.
+    vector<pair<int, PageId> > level;
+    level.swap(bulkLeaves);
+    int height = 1;
+
+    BTNonLeafNode node(pf.getPageSize());
+    int target = (int)(bulkFill * node.getMaxKeyCount());
+    if (target < 2) {
+        target = 2;
+    }
+
+    while (level.size() > 1) {
+        vector<pair<int, PageId> > upper;
+        size_t n = level.size();
+        size_t i = 0;
+        while (i < n) {
+            // a node takes up to target + 1 children. never leave a
+            // single child for the last node, which needs at least one key.
+            size_t end = min(n, i + target + 1);
+            if (n - end == 1) {
+                end--;
+            }
+
+            node = BTNonLeafNode(pf.getPageSize());
+            node.initializeRoot(level[i].second, level[i + 1].first, level[i + 1].second);
+            for (size_t j = i + 2; j < end; j++) {
+                if ((rc = node.insert(level[j].first, level[j].second)) < 0) {
+                    return rc;
+                }
+            }
+            PageId pid;
+            if ((rc = allocatePage(pid)) < 0 || (rc = node.write(pid, pf)) < 0) {
+                return rc;
+            }
+            upper.push_back(make_pair(level[i].first, pid));
+            i = end;
+        }
+        level.swap(upper);
+        height++;
+    }
+
+    rootPid = level[0].second;
+    treeHeight = height;
     return 0;
 }
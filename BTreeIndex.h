@@ -10,9 +10,19 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <cstdint>
+#include <string>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -25,15 +35,193 @@ typedef struct {
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // The smallest key the cursor may return next. If the leaf was
+  // changed by an insert since eid was found, eid is found again by key.
+  int     key;
+  // The version of the leaf when eid was found
+  uint64_t version;
+  // While the cursor is inside the posting list of a duplicate key, the
+  // posting page and the entry in it to read next. While the list is
+  // still a run of a shared posting page, listPid is -1 and listEid is
+  // the entry of the run to read next. Both are -1 and 0 otherwise.
+  PageId  listPid;
+  int     listEid;
 } IndexCursor;
 
+/**
+ * A version latch for optimistic lock coupling. The lowest bit is set
+ * while a writer holds the latch, and releasing the latch advances the
+ * version. A reader notes the version before reading a node and checks
+ * that it is unchanged afterwards. If it changed, what the reader saw
+ * may be torn and the reader starts over. Readers never write the latch.
+ */
+class VersionLatch {
+ public:
+  VersionLatch() : word(0) {}
+
+  /**
+   * Wait until no writer holds the latch.
+   * @return the current version
+   */
+  uint64_t readLock() const;
+
+  /**
+   * @param version[IN] a version returned by readLock()
+   * @return true if nothing was written since version was read
+   */
+  bool validate(uint64_t version) const;
+
+  /**
+   * Take the latch for writing if nothing was written since version.
+   * @param version[IN] a version returned by readLock()
+   * @return true if the latch was taken
+   */
+  bool upgrade(uint64_t version);
+
+  /**
+   * Release the latch taken by upgrade() and advance the version.
+   */
+  void writeUnlock();
+
+ private:
+  std::atomic<uint64_t> word;
+};
+
+/**
+ * The non-leaf nodes of an index file decoded in memory, up to a budget.
+ * Since every lookup starts at the root, a node closer to the root is
+ * worth more: when the budget is used up, a node replaces the cached
+ * nodes closest to the leaves, but never one higher up than itself.
+ * A node is cached with the version of its VersionLatch and is used only
+ * while the latch still has that version.
+ *
+ * The cache of a file opened in 'r' mode outlives the BTreeIndex that
+ * filled it: the next BTreeIndex opened on the same file finds it again,
+ * as long as the file was not modified in between. An index opened in
+ * 'w' mode has a cache of its own.
+ */
+class NodeCache {
+ public:
+  static const int MAX_SHARED_FILES = 8;  // the # of files whose caches are kept
+
+  /**
+   * A non-leaf node decoded in memory. keys[i] separates the children
+   * pids[i] and pids[i+1].
+   */
+  struct Node {
+    uint64_t            version;  /// the version of the node decoded
+    int                 depth;    /// the # of levels from the node to the leaves
+    bool                full;     /// true if the node has no room for a key
+    std::vector<int>    keys;
+    std::vector<PageId> pids;
+
+    /// the child to follow for searchKey
+    PageId child(int searchKey) const;
+  };
+
+  /**
+   * @param budget[IN] the most memory the decoded nodes may take
+   */
+  explicit NodeCache(size_t budget);
+
+  /**
+   * Find the children of a cached node to follow for n keys.
+   * @param pid[IN] the node
+   * @param version[IN] the current version of the node
+   * @param keys[IN] the keys being looked up
+   * @param order[IN] the indexes of the keys to route. NULL for all n
+   * @param n[IN] the # of keys to route
+   * @param children[OUT] the child node to follow for each key
+   * @param full[OUT] if not NULL, set to true if the node is full
+   * @return false if the node is not cached with the version
+   */
+  bool route(PageId pid, uint64_t version, const int* keys, const int* order, int n,
+             PageId* children, bool* full) const;
+
+  /**
+   * Check whether a node would be cached, before it is decoded.
+   * @param pid[IN] the node
+   * @param depth[IN] the # of levels from the node to the leaves
+   * @param keyCount[IN] the # of keys of the node
+   * @return true if there is room for it
+   */
+  bool admits(PageId pid, int depth, int keyCount) const;
+
+  /**
+   * Cache a decoded node, dropping nodes closer to the leaves if needed.
+   * @param pid[IN] the node
+   * @param node[IN] the decoded node
+   */
+  void add(PageId pid, Node&& node);
+
+  /**
+   * Drop all nodes.
+   */
+  void clear();
+
+  /**
+   * Return the cache of an index file opened in 'r' mode. The cache left
+   * by an earlier open is returned if the file has the same modification
+   * time and size as then, and an empty one otherwise.
+   * @param filename[IN] the index file
+   * @param budget[IN] the budget of a new cache
+   * @return the cache of the file
+   */
+  static std::shared_ptr<NodeCache> forFile(const std::string& filename, size_t budget);
+
+  /**
+   * Forget the cache of an index file about to be modified.
+   * @param filename[IN] the index file
+   */
+  static void dropFile(const std::string& filename);
+
+ private:
+  // the memory taken by a decoded node with keyCount keys
+  static size_t nodeSize(size_t keyCount);
+
+  // make room for bytes more by dropping nodes less deep than depth.
+  // the caller holds latch for writing.
+  bool makeRoom(size_t bytes, int depth);
+
+  std::unordered_map<PageId, Node> nodes;
+  std::vector<std::vector<PageId> > byDepth;  /// the cached nodes by their depth
+  std::vector<size_t> depthBytes;             /// the memory they take by depth
+  size_t bytes;    /// the memory taken by the nodes
+  size_t budget;   /// the most memory the nodes may take
+  mutable std::shared_mutex latch;  /// protects all of the above
+};
+
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ * The non-leaf nodes visited by lookups are kept decoded in a NodeCache,
+ * up to a budget read from the environment variable
+ * BRUINBASE_INDEX_CACHE_KB (default 1024) for each index file. A lookup
+ * through the cached upper levels reads only the lower levels and the
+ * leaf from the PageFile.
+ *
+ * An index opened in 'w' mode may be used by several threads at once.
+ * insert(), locate(), locateBatch(), readForward() and readLeafKeys()
+ * follow optimistic lock coupling: every node has a VersionLatch, readers
+ * take no lock and start over if a node changed while they read it, and
+ * an insert locks only the leaf it changes, plus its parent if the leaf
+ * splits. Full non-leaf nodes are split on the way down, so a split never
+ * goes up more than one level. A cursor stays usable while other threads
+ * insert. Bulk loading and close() must not run concurrently with others.
+ *
+ * A key may be inserted more than once. The leaves still hold each key
+ * once. The RecordId of a key with a single record is stored in its leaf
+ * entry. Once a key has more records, the entry refers to a posting list
+ * holding its RecordIds in insertion order. A short list is a run in a
+ * shared posting page, which packs the runs of many keys. Only a list
+ * that outgrows the largest run gets a chain of posting pages of its own.
+ * readForward() returns every RecordId of a key in turn.
  */
 class BTreeIndex {
  public:
+  static const int DEFAULT_INDEX_CACHE_KB = 1024;  // default cache budget
+
   BTreeIndex();
+  ~BTreeIndex();
 
   /**
    * Open the index file in read or write mode.
@@ -52,6 +240,7 @@ class BTreeIndex {
     
   /**
    * Insert (key, RecordId) pair to the index.
+   * If the key is already in the index, rid is added to its posting list.
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
@@ -78,6 +267,20 @@ class BTreeIndex {
    */
   RC locate(int searchKey, IndexCursor& cursor);
 
+  /**
+   * Run locate() for many keys at once. The keys are sorted and the tree
+   * is walked once for all of them, so every node on the paths to the
+   * keys is read only once, however many keys route through it. The
+   * leaves of a batch are read ahead before the first of them is visited.
+   * out[i] is set to the cursor locate() would return for keys[i].
+   * Whether keys[i] exists is seen from the key readForward() returns.
+   * @param keys[IN] the keys to find, in any order
+   * @param n[IN] the # of keys
+   * @param out[OUT] the cursors for the keys
+   * @return error code. 0 if no error
+   */
+  RC locateBatch(const int* keys, int n, IndexCursor* out);
+
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
    * and move foward the cursor to the next entry.
@@ -87,16 +290,391 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Read the keys from the cursor location to the end of its leaf node,
+   * stopping at the first key larger than hi, and move the cursor to the
+   * next leaf through the next-node pointer. This lets a query that only
+   * needs the keys walk the leaf level without looking up any RecordId.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param hi[IN] the largest key to read
+   * @param keys[OUT] the keys read, in ascending order. a duplicate key
+   *                  appears once for each of its records
+   * @return error code. RC_END_OF_TREE if there is no key <= hi left
+   */
+  RC readLeafKeys(IndexCursor& cursor, int hi, std::vector<int>& keys);
+
+  /**
+   * Read the (key, rid) pairs from the cursor location to the end of its
+   * leaf node like readLeafKeys(), along with their RecordIds.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param hi[IN] the largest key to read
+   * @param keys[OUT] the keys read, in ascending order. a duplicate key
+   *                  appears once for each of its records
+   * @param rids[OUT] rids[i] is the RecordId of keys[i]
+   * @return error code. RC_END_OF_TREE if there is no key <= hi left
+   */
+  RC readLeafEntries(IndexCursor& cursor, int hi, std::vector<int>& keys,
+                     std::vector<RecordId>& rids);
+
+  /**
+   * Have the operating system read ahead the leaves holding the keys
+   * from lo up to hi, at most count of them, without waiting for them.
+   * The leaves are found from their parent nodes, so no leaf is read.
+   * @param lo[IN/OUT] the smallest key. set to the smallest key the
+   *                   leaves after the ones read ahead may hold
+   * @param hi[IN] the largest key
+   * @param count[IN/OUT] the most leaves to read ahead. set to the #
+   *                      of leaves read ahead
+   * @return error code. RC_END_OF_TREE if no leaf of the range is left
+   *         after the ones read ahead
+   */
+  RC prefetchLeaves(int& lo, int hi, int& count);
+
+  /**
+   * Start building an empty index bottom-up from (key, RecordId) pairs
+   * given in ascending key order by bulkLoadAppend(). The leaves are
+   * written left to right, each filled up to fillFactor of its capacity,
+   * and the non-leaf levels are built on top of them by bulkLoadEnd().
+   * Packed leaves hold up to twice the entries of plain ones when the keys
+   * are dense and the RecordIds clustered, which makes the tree smaller
+   * and range scans cheaper. Inserts keep them packed while they fit.
+   * @param fillFactor[IN] the fraction of each node to fill (0, 1]
+   * @param packLeaves[IN] true to build packed leaves
+   * @return error code. RC_INDEX_NOT_EMPTY if the index already has keys
+   */
+  RC bulkLoadBegin(double fillFactor, bool packLeaves = false);
+
+  /**
+   * Add the next (key, RecordId) pair of a bulk load.
+   * @param key[IN] the key. it must not be smaller than the previous key
+   * @param rid[IN] the RecordId for the record with the key
+   * @return error code. 0 if no error
+   */
+  RC bulkLoadAppend(int key, const RecordId& rid);
+
+  /**
+   * Finish a bulk load by writing the last leaf and the non-leaf levels.
+   * @return error code. 0 if no error
+   */
+  RC bulkLoadEnd();
+
+  /**
+   * Return the number of (key, RecordId) entries in the index, as recorded
+   * in the metadata. A key inserted several times counts once per record.
+   * @return the # of entries. -1 if the index file does not record it
+   */
+  int getKeyCount() const { return keyCount; }
+
+  /**
+   * Record the end of the table when the index has all of its tuples.
+   * It is stored in the metadata when the index is closed, so that a
+   * reader can tell whether the table changed without the index.
+   * @param end[IN] the endRid() of the table
+   */
+  void setTableEnd(const RecordId& end);
+
+  /**
+   * Return the end of the table recorded by setTableEnd().
+   * @return the endRid() of the table covered by the index.
+   *         (-1, -1) if the index file does not record it
+   */
+  const RecordId& getTableEnd() const { return tableEnd; }
+
+  /**
+   * Return the smallest and the largest key in the index, so that a
+   * range that cannot match any key can be skipped without a lookup.
+   * @param min[OUT] the smallest key
+   * @param max[OUT] the largest key
+   * @return false if the index is empty or the bounds are not known
+   */
+  bool getKeyBounds(int& min, int& max) const;
+
+  /**
+   * @return the height of the tree. 0 if the index is empty
+   */
+  int getTreeHeight() const { return treeHeight; }
   
  private:
+  /**
+   * Make one attempt to insert (key, rid). The attempt is abandoned and
+   * restart is set if a node on the way changed under it, or after it
+   * split a full non-leaf node on the way down.
+   * @param restart[OUT] true if the insert has to be tried again
+   * @return error code. 0 if no error
+   */
+  RC tryInsert(int key, const RecordId& rid, bool& restart);
+
+  /**
+   * Add the new right sibling of a split node to the parent. The caller
+   * holds the latch of the parent, or the tree latch if the split node is
+   * the root, in which case a new root is made.
+   * @param parentPid[IN] the parent. -1 if the split node is the root
+   * @param left[IN] the split node
+   * @param key[IN] the key separating the two nodes
+   * @param right[IN] the new right sibling
+   * @return error code. 0 if no error
+   */
+  RC addToParent(PageId parentPid, PageId left, int key, PageId right);
+
+  /**
+   * Add rid to the records of a key, turning its leaf entry into a posting
+   * list if it held a single RecordId. The caller holds the latch of the
+   * leaf and stores a changed entry in the leaf afterwards.
+   * @param entry[IN/OUT] the RecordId of the leaf entry of the key
+   * @param rid[IN] the RecordId to add
+   * @return error code. 0 if no error
+   */
+  RC appendPosting(RecordId& entry, const RecordId& rid);
+
+  /**
+   * Check whether appendPosting() can add a RecordId to a posting list
+   * without changing the leaf entry of the key.
+   * @param entry[IN] the RecordId of the leaf entry of the key
+   * @return true if the entry stays the same
+   */
+  bool postingStays(const RecordId& entry);
+
+  /**
+   * Copy the RecordIds of a posting list into a new run of a shared
+   * posting page, taking a new shared page if the current one is full.
+   * @param rids[IN] the RecordIds of the list
+   * @param count[IN] the # of RecordIds
+   * @param capacity[IN] the # of RecordIds the run can hold
+   * @param entry[OUT] the leaf entry referring to the run
+   * @return error code. 0 if no error
+   */
+  RC newRun(const RecordId* rids, int count, int capacity, RecordId& entry);
+
+  /**
+   * Copy the RecordIds of a posting list into a new posting page, which
+   * starts a chain of its own.
+   * @param rids[IN] the RecordIds of the list. they fit in one page
+   * @param count[IN] the # of RecordIds
+   * @param entry[OUT] the leaf entry referring to the chain
+   * @return error code. 0 if no error
+   */
+  RC newChain(const RecordId* rids, int count, RecordId& entry);
+
+  /**
+   * Add rid at the end of the chain of posting pages starting at headPid.
+   * @param headPid[IN] the first posting page of the chain
+   * @param rid[IN] the RecordId to add
+   * @return error code. 0 if no error
+   */
+  RC appendChain(PageId headPid, const RecordId& rid);
+
+  /**
+   * Write the leaf being bulk loaded and start a new one.
+   * @param key[IN] the first key of the new leaf
+   * @return error code. 0 if no error
+   */
+  RC bulkLoadLeaf(int key);
+
+  /**
+   * Read the RecordId at the cursor position in a posting list and move
+   * the cursor forward. The caller checks the leaf version afterwards.
+   * A run that became a chain since the cursor was placed in it is read
+   * on from the same entry of the first page of the chain.
+   * @param entry[IN] the RecordId of the leaf entry of the key
+   * @param listPid[IN/OUT] the posting page to read. -1 inside a run
+   * @param listEid[IN/OUT] the entry to read in the posting page or run
+   * @param rid[OUT] the RecordId read
+   * @param found[OUT] false if the list has no RecordId left
+   * @return error code. 0 if no error
+   */
+  RC readPosting(const RecordId& entry, PageId& listPid, int& listEid, RecordId& rid,
+                 bool& found);
+
+  /**
+   * Return the # of RecordIds in a posting list.
+   * @param entry[IN] the RecordId of the leaf entry of the key
+   * @param total[OUT] the # of RecordIds
+   * @return error code. 0 if no error
+   */
+  RC postingCount(const RecordId& entry, int& total);
+
+  /**
+   * Read the leaf entries for readLeafKeys() and readLeafEntries().
+   * @param rids[OUT] the RecordIds of the keys. NULL if not needed
+   */
+  RC readLeaf(IndexCursor& cursor, int hi, std::vector<int>& keys,
+              std::vector<RecordId>* rids);
+
+  /**
+   * Run locate() once for each key of a batch whose path changed while
+   * locateBatch() walked it.
+   * @return error code. 0 if no error
+   */
+  RC locateEach(const int* keys, const int* order, int n, IndexCursor* out);
+
+  /**
+   * Read one entry at the cursor or move the cursor to the next leaf.
+   * @param found[OUT] true if an entry was read
+   * @param restart[OUT] true if the leaf changed while it was read
+   * @return error code. 0 if no error
+   */
+  RC tryReadForward(IndexCursor& cursor, int& key, RecordId& rid, bool& found, bool& restart);
+
+  /**
+   * @param pid[IN] a node of the tree
+   * @return the version latch of the node
+   */
+  VersionLatch& nodeLatch(PageId pid);
+
+  /**
+   * Store the metadata of the tree in page 0 of the index file.
+   * @return error code. 0 if no error
+   */
+  RC writeMeta();
+
+  /**
+   * Get a page for a new node at the end of the file.
+   * @param pid[OUT] the page to use
+   * @return error code. 0 if no error
+   */
+  RC allocatePage(PageId& pid);
+
+  /**
+   * Account for a key added to the index in the key statistics.
+   * @param key[IN] the added key
+   */
+  void addKey(int key);
+
+  /**
+   * Run locateBatch() on the subtree rooted at pid.
+   * @param pid[IN] the root of the subtree
+   * @param version[IN] the version of pid noted while reaching it
+   * @param depth[IN] the # of levels from pid down to the leaves. 1 for a leaf
+   * @param keys[IN] all keys of the batch
+   * @param order[IN] the indexes of the keys routed to pid, in key order
+   * @param n[IN] the # of entries in order
+   * @param out[OUT] the cursors for all keys of the batch
+   * @return error code. 0 if no error
+   */
+  RC locateBatchIn(PageId pid, uint64_t version, int depth, const int* keys,
+                   const int* order, int n, IndexCursor* out);
+
+  /**
+   * Find the children of the non-leaf node pid to follow for n keys,
+   * using the decoded copy of the node if it is cached. A node read from
+   * the PageFile is cached if the budget allows. The caller checks the
+   * version of the node afterwards, since a torn read may give any child.
+   * @param pid[IN] the non-leaf node
+   * @param version[IN] the version of the node noted by the caller
+   * @param depth[IN] the # of levels from the node to the leaves
+   * @param keys[IN] the keys being looked up
+   * @param order[IN] the indexes of the keys to route. NULL for all n
+   * @param n[IN] the # of keys to route
+   * @param children[OUT] the child node to follow for each key
+   * @param full[OUT] if not NULL, set to true if the node is full
+   * @return error code. 0 if no error
+   */
+  RC routeKeys(PageId pid, uint64_t version, int depth, const int* keys, const int* order,
+               int n, PageId* children, bool* full = NULL);
+
+  /**
+   * Keep a decoded copy of a non-leaf node read from the PageFile,
+   * if it fits in the budget and did not change while it was decoded.
+   * @param pid[IN] the non-leaf node
+   * @param version[IN] the version of the node noted before reading it
+   * @param depth[IN] the # of levels from the node to the leaves
+   * @param node[IN] the node
+   */
+  void cacheNode(PageId pid, uint64_t version, int depth, BTNonLeafNode& node);
+
+  /**
+   * Drop the version latches of the nodes.
+   */
+  void freeLatches();
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
-  PageId   rootPid;    /// the PageId of the root node
-  int      treeHeight; /// the height of the tree
-  /// Note that the content of the above two variables will be gone when
-  /// this class is destructed. Make sure to store the values of the two 
-  /// variables in disk, so that they can be reconstructed when the index
-  /// is opened again later.
+  std::atomic<PageId> rootPid;  /// the PageId of the root node
+  std::atomic<int> treeHeight;  /// the height of the tree
+  int      keyCount;   /// the # of (key, RecordId) entries. -1 if not known
+  int      minKey;     /// the smallest key, if keyCount > 0
+  int      maxKey;     /// the largest key, if keyCount > 0
+  RecordId tableEnd;   /// the end of the table covered. (-1, -1) if not known
+  PageId   runPid;     /// the shared posting page new runs go to. -1 if none
+  /// The above variables are stored in page 0 of the index file
+  /// when the index is closed and read back when it is opened again.
+
+  bool     writable;   /// true if the index was opened in 'w' mode
+
+  /// the latch of rootPid and treeHeight, the parent of the root
+  VersionLatch treeLatch;
+  /// the latches of the nodes, LATCH_CHUNK_SIZE pages per chunk, allocated
+  /// when a page of the chunk is first used. NULL unless writable, since
+  /// nothing changes the nodes of an index opened in 'r' mode.
+  static const int LATCH_CHUNK_BITS = 16;
+  static const int LATCH_CHUNK_SIZE = 1 << LATCH_CHUNK_BITS;
+  static const int LATCH_CHUNK_COUNT = (0x7fffffff >> LATCH_CHUNK_BITS) + 1;
+  std::unique_ptr<std::atomic<VersionLatch*>[]> latchChunks;
+  VersionLatch fixedLatch;  /// the latch of every node if latchChunks is NULL
+
+  /// protects the page allocation and the key statistics against
+  /// concurrent inserts
+  std::mutex metaLatch;
+
+  /// protects runPid and the free space of the shared posting pages
+  /// against concurrent inserts
+  std::mutex runLatch;
+
+  /// the decoded non-leaf nodes. NULL while the index is not open
+  std::shared_ptr<NodeCache> nodeCache;
+  size_t   cacheBudget;  /// the most memory nodeCache may use
+
+  /// the state of a bulk load
+  double     bulkFill;     /// the fill factor of the nodes
+  bool       bulkPack;     /// true if the leaves are packed
+  int        bulkTarget;   /// the # of entries to fill a leaf with
+  PageId     bulkLeafPid;  /// the leaf being filled. -1 if none
+  std::vector<int> bulkKeys;       /// the keys of the leaf being filled
+  std::vector<RecordId> bulkRids;  /// the RecordIds of the leaf being filled
+  LeafRanges bulkRanges;   /// the ranges of the entries of the leaf being filled
+  int        bulkLastKey;  /// the last key appended
+  std::vector<std::pair<int, PageId> > bulkLeaves;  /// (first key, pid) of the leaves
+};
+
+/**
+ * A scan of the (key, RecordId) pairs of an index with keys in [lo, hi].
+ * next() returns the pairs a leaf at a time. While the caller works on
+ * them, the following leaves of the range are being read ahead, so that
+ * a long scan does not wait for the disk once per leaf.
+ */
+class IndexScan {
+ public:
+  static const int DEFAULT_READ_AHEAD = 16;  // leaves read ahead
+
+  /**
+   * Start a scan of the index.
+   * @param index[IN] the index to scan. it stays open during the scan
+   * @param lo[IN] the smallest key to read
+   * @param hi[IN] the largest key to read
+   * @param readAhead[IN] the # of leaves to keep read ahead
+   */
+  IndexScan(BTreeIndex& index, int lo, int hi, int readAhead = DEFAULT_READ_AHEAD);
+
+  /**
+   * Read the next batch of (key, RecordId) pairs in ascending key order.
+   * @param keys[OUT] the keys read. a duplicate key appears once for
+   *                  each of its records
+   * @param rids[OUT] rids[i] is the RecordId of keys[i]
+   * @return error code. RC_END_OF_TREE if no pair of the range is left
+   */
+  RC next(std::vector<int>& keys, std::vector<RecordId>& rids);
+
+ private:
+  BTreeIndex& index;
+  IndexCursor cursor;
+  int  lo;           /// the smallest key to read
+  int  hi;           /// the largest key to read
+  bool started;      /// true once the first leaf was located
+  int  readAhead;    /// the # of leaves to keep read ahead
+  int  pending;      /// the # of leaves read ahead and not read yet
+  int  aheadKey;     /// the smallest key of the leaves not read ahead yet
+  bool aheadDone;    /// true if all leaves of the range were read ahead
 };
 
 #endif /* BTREEINDEX_H */
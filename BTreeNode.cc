@@ -1,19 +1,304 @@
 #include "BTreeNode.h"
 #include <iostream>
-#include <math.h>
 #include <cstring>
+#include <utility>
+#include <climits>
+#include <cstdint>
 
 using namespace std;
 
+//
+// A leaf node starts with a header holding the number of keys and the
+// PageId of the next sibling. The keys follow as one contiguous array
+// and the RecordIds as another, so that a node search compares keys
+// without touching the RecordIds.
+// A non-leaf node starts with the number of keys, followed by the array
+// of keys and the array of child pointers. The i'th key separates the
+// i'th and the (i+1)'th child.
+//
+#define LEAF_HEADER_SIZE        (sizeof(int) + sizeof(PageId))
 #define LEAF_ENTRY_SIZE         (sizeof(RecordId) + sizeof(int))
-#define LEAF_CAPACITY           ((PageFile::PAGE_SIZE-sizeof(PageId))/LEAF_ENTRY_SIZE)
-#define PAGE_ID_OFFSET          (PageFile::PAGE_SIZE - sizeof(PageId)-1)
+#define LEAF_CAPACITY(size)     ((int)(((size)-LEAF_HEADER_SIZE)/LEAF_ENTRY_SIZE))
+#define NEXT_PID_OFFSET         (sizeof(int))
+#define NON_LEAF_HEADER_SIZE    (sizeof(int))
 #define NON_LEAF_ENTRY_SIZE     (sizeof(PageId) + sizeof(int))
-#define NON_LEAF_CAPACITY       ((PageFile::PAGE_SIZE-sizeof(PageId))/NON_LEAF_ENTRY_SIZE)
+#define NON_LEAF_CAPACITY(size) ((int)(((size)-NON_LEAF_HEADER_SIZE-sizeof(PageId))/NON_LEAF_ENTRY_SIZE))
 
-BTLeafNode::BTLeafNode()
+// the capacities of the nodes of the largest pages
+#define MAX_LEAF_CAPACITY       LEAF_CAPACITY(PageFile::MAX_PAGE_SIZE)
+#define MAX_NON_LEAF_CAPACITY   NON_LEAF_CAPACITY(PageFile::MAX_PAGE_SIZE)
+
+// pointers to the eid'th key and the eid'th RecordId of a leaf
+// holding up to cap keys
+#define LEAF_KEY(buf, eid)      ((buf) + LEAF_HEADER_SIZE + (eid)*sizeof(int))
+#define LEAF_RID(buf, cap, eid) ((buf) + LEAF_HEADER_SIZE + (cap)*sizeof(int) + (eid)*sizeof(RecordId))
+// pointers to the eid'th key and the eid'th child pointer of a non-leaf
+// holding up to cap keys
+#define NON_LEAF_KEY(buf, eid)  ((buf) + NON_LEAF_HEADER_SIZE + (eid)*sizeof(int))
+#define NON_LEAF_PID(buf, cap, eid) ((buf) + NON_LEAF_HEADER_SIZE + (cap)*sizeof(int) + (eid)*sizeof(PageId))
+
+static inline int readInt(const char* ptr)
+{
+    int value;
+    memcpy(&value, ptr, sizeof(int));
+    return value;
+}
+
+static inline void writeInt(char* ptr, int value)
+{
+    memcpy(ptr, &value, sizeof(int));
+}
+
+//
+// A packed leaf sets LEAF_PACKED in its key count. The header is followed
+// by the smallest key, page id and slot number of the node and by the
+// number of bits each of them takes. Every key, page id and slot number
+// is stored as its difference from the smallest one in that many bits:
+// first the keys of all entries, then their page ids, then their slot
+// numbers. Since every entry takes the same number of bits, an entry is
+// read without decoding the ones before it. Dense keys and clustered
+// RecordIds take a fraction of the 12 bytes of a plain entry.
+//
+#define LEAF_PACKED             0x40000000
+#define PACKED_BASE_OFFSET      LEAF_HEADER_SIZE
+#define PACKED_BITS_OFFSET      (LEAF_HEADER_SIZE + 3*sizeof(int))
+#define PACKED_HEADER_SIZE      (PACKED_BITS_OFFSET + 4)
+// the bits are read 8 bytes at a time, which may run past the last entry
+#define PACKED_TAIL_SIZE        sizeof(uint64_t)
+// a packed leaf holds fewer than twice the entries of a plain leaf,
+// so that either half of a split packed leaf fits in a plain leaf
+#define PACKED_CAPACITY(size)   (2*LEAF_CAPACITY(size) - 1)
+#define MAX_PACKED_CAPACITY     PACKED_CAPACITY(PageFile::MAX_PAGE_SIZE)
+
+// the header of a packed leaf
+struct PackedLayout {
+    int    count;
+    int    keyBase;
+    PageId pidBase;
+    int    sidBase;
+    int    keyBits;
+    int    pidBits;
+    int    sidBits;
+};
+
+static inline int packedSize(int count, int bits)
+{
+    return PACKED_HEADER_SIZE + (int)(((long long)count * bits + 7) / 8) + PACKED_TAIL_SIZE;
+}
+
+// the number of bits taken by the differences of the values in [lo, hi]
+static inline int bitsFor(int lo, int hi)
+{
+    uint32_t range = (lo < hi) ? (uint32_t)hi - (uint32_t)lo : 0;
+    return (range == 0) ? 0 : 32 - __builtin_clz(range);
+}
+
+static inline uint32_t readBits(const char* data, long long bit, int width)
+{
+    if (width == 0) {
+        return 0;
+    }
+    uint64_t word;
+    memcpy(&word, data + (bit >> 3), sizeof(word));
+    return (uint32_t)((word >> (bit & 7)) & (~0ULL >> (64 - width)));
+}
+
+// store value in width bits at bit. the bits must be zero.
+static inline void writeBits(char* data, long long bit, int width, uint32_t value)
+{
+    if (width == 0) {
+        return;
+    }
+    uint64_t word;
+    memcpy(&word, data + (bit >> 3), sizeof(word));
+    word |= (uint64_t)value << (bit & 7);
+    memcpy(data + (bit >> 3), &word, sizeof(word));
+}
+
+// read the header of a packed leaf. a reader may see the header while
+// a writer changes it; return false if it does not describe a valid node.
+static bool readLayout(const char* buf, int pageSize, PackedLayout& l)
+{
+    l.count = readInt(buf) & ~LEAF_PACKED;
+    l.keyBase = readInt(buf + PACKED_BASE_OFFSET);
+    l.pidBase = readInt(buf + PACKED_BASE_OFFSET + sizeof(int));
+    l.sidBase = readInt(buf + PACKED_BASE_OFFSET + 2*sizeof(int));
+    l.keyBits = (unsigned char) buf[PACKED_BITS_OFFSET];
+    l.pidBits = (unsigned char) buf[PACKED_BITS_OFFSET + 1];
+    l.sidBits = (unsigned char) buf[PACKED_BITS_OFFSET + 2];
+    return l.count >= 0 && l.count <= PACKED_CAPACITY(pageSize) &&
+           l.keyBits <= 32 && l.pidBits <= 32 && l.sidBits <= 32 &&
+           packedSize(l.count, l.keyBits + l.pidBits + l.sidBits) <= pageSize;
+}
+
+// read the eid'th entry of a packed leaf
+static inline void readPacked(const char* buf, const PackedLayout& l, int eid,
+                              int& key, RecordId& rid)
 {
-    std::fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
+    const char* bits = buf + PACKED_HEADER_SIZE;
+    long long pidStart = (long long)l.count * l.keyBits;
+    long long sidStart = pidStart + (long long)l.count * l.pidBits;
+    key = (int)((uint32_t)l.keyBase + readBits(bits, (long long)eid * l.keyBits, l.keyBits));
+    rid.pid = (PageId)((uint32_t)l.pidBase + readBits(bits, pidStart + (long long)eid * l.pidBits, l.pidBits));
+    rid.sid = (int)((uint32_t)l.sidBase + readBits(bits, sidStart + (long long)eid * l.sidBits, l.sidBits));
+}
+
+LeafRanges::LeafRanges()
+{
+    minKey = minPid = minSid = INT_MAX;
+    maxKey = maxPid = maxSid = INT_MIN;
+}
+
+void LeafRanges::add(int key, const RecordId& rid)
+{
+    minKey = min(minKey, key);
+    maxKey = max(maxKey, key);
+    minPid = min(minPid, rid.pid);
+    maxPid = max(maxPid, rid.pid);
+    minSid = min(minSid, rid.sid);
+    maxSid = max(maxSid, rid.sid);
+}
+
+int LeafRanges::packedSize(int count) const
+{
+    return ::packedSize(count, bitsFor(minKey, maxKey) + bitsFor(minPid, maxPid) +
+                               bitsFor(minSid, maxSid));
+}
+
+/*
+ * A search kernel returns the number of keys among the n sorted keys
+ * starting at keys that are smaller than searchKey.
+ */
+typedef int (*SearchKernel)(const char* keys, int n, int searchKey);
+
+/*
+ * The portable kernel is a binary search whose loop body compiles to
+ * conditional moves instead of branches.
+ */
+static int countSmallerScalar(const char* keys, int n, int searchKey)
+{
+    int lo = 0;
+    int len = n;
+    while (len > 0) {
+        int half = len >> 1;
+        bool smaller = readInt(keys + (lo + half) * sizeof(int)) < searchKey;
+        lo = smaller ? lo + half + 1 : lo;
+        len = smaller ? len - half - 1 : half;
+    }
+    return lo;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * The vector kernels compare searchKey against 4 or 8 keys per
+ * instruction and count the smaller ones. A node is small enough that
+ * comparing every key is cheaper than the mispredicted branches of a
+ * binary search.
+ */
+__attribute__((target("sse4.2,popcnt")))
+static int countSmallerSse4(const char* keys, int n, int searchKey)
+{
+    __m128i x = _mm_set1_epi32(searchKey);
+    int count = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i k = _mm_loadu_si128((const __m128i*)(keys + i * sizeof(int)));
+        __m128i lt = _mm_cmpgt_epi32(x, k);
+        count += _mm_popcnt_u32(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+    }
+    for (; i < n; i++) {
+        count += readInt(keys + i * sizeof(int)) < searchKey;
+    }
+    return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int countSmallerAvx2(const char* keys, int n, int searchKey)
+{
+    __m256i x = _mm256_set1_epi32(searchKey);
+    int count = 0;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i k = _mm256_loadu_si256((const __m256i*)(keys + i * sizeof(int)));
+        __m256i lt = _mm256_cmpgt_epi32(x, k);
+        count += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+    }
+    for (; i < n; i++) {
+        count += readInt(keys + i * sizeof(int)) < searchKey;
+    }
+    return count;
+}
+#endif
+
+// pick the widest kernel the processor supports
+static SearchKernel chooseKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return countSmallerAvx2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return countSmallerSse4;
+    }
+#endif
+    return countSmallerScalar;
+}
+
+static const SearchKernel countSmaller = chooseKernel();
+
+// the number of keys not larger than searchKey
+static inline int countNotLarger(const char* keys, int n, int searchKey)
+{
+    return (searchKey == INT_MAX) ? n : countSmaller(keys, n, searchKey + 1);
+}
+
+BTLeafNode::BTLeafNode(int size)
+{
+    localSize = 0;
+    useLocal(size);
+    std::fill(buffer, buffer + pageSize, 0);
+}
+
+/*
+ * Copying a node copies its content into the local buffer of the new node.
+ */
+BTLeafNode::BTLeafNode(const BTLeafNode& other)
+{
+    localSize = 0;
+    useLocal(other.pageSize);
+    memcpy(buffer, other.buffer, pageSize);
+}
+
+BTLeafNode& BTLeafNode::operator= (const BTLeafNode& other)
+{
+    if (this != &other) {
+        // other keeps its own pin, so its content stays valid
+        page.unpin();
+        useLocal(other.pageSize);
+        memcpy(buffer, other.buffer, pageSize);
+    }
+    return *this;
+}
+
+void BTLeafNode::setPageSize(int size)
+{
+    pageSize = size;
+    capacity = LEAF_CAPACITY(size);
+}
+
+// lay the node out in the local buffer for pages of the given size.
+// the content of the buffer is undefined afterwards.
+void BTLeafNode::useLocal(int size)
+{
+    if (localSize < size) {
+        local.reset(new char[size]);
+        localSize = size;
+    }
+    buffer = local.get();
+    setPageSize(size);
 }
 /**
  * Read the content of the node from the page pid in the PageFile pf.
@@ -23,9 +308,17 @@ BTLeafNode::BTLeafNode()
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
 {
-    return pf.read(pid,buffer);
+    RC rc;
+    PageHandle handle;
+    if ((rc = pf.fetch(pid, handle)) < 0) {
+        return rc;
+    }
+    page = std::move(handle);
+    buffer = page.data();
+    setPageSize(pf.getPageSize());
+    return 0;
 }
-    
+
 /**
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -34,7 +327,28 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
 {
-    return pf.write(pid,buffer);
+    // the node was laid out for pages of a different size
+    if (pf.getPageSize() != pageSize) {
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    // the node already lives in the frame of the page
+    if (page.isPinned() && page.file() == &pf && page.pid() == pid) {
+        page.markDirty();
+        return 0;
+    }
+
+    // copy the node into the frame of the page and refer to it from now on
+    RC rc;
+    PageHandle handle;
+    if ((rc = pf.fetchNew(pid, handle)) < 0) {
+        return rc;
+    }
+    memcpy(handle.data(), buffer, pageSize);
+    handle.markDirty();
+    page = std::move(handle);
+    buffer = page.data();
+    return 0;
 }
 
 /**
@@ -43,17 +357,42 @@ RC BTLeafNode::write(PageId pid, PageFile& pf)
  */
 int BTLeafNode::getKeyCount()
 {
-    int count = 0;
-    int cursor = 0;
-    int lastStartingIndex = (LEAF_CAPACITY-1)*LEAF_ENTRY_SIZE;
-    while(cursor<=lastStartingIndex){
-        if(isBlockEmpty(cursor)){
-            break;
-        }
-        count ++;
-        cursor+=LEAF_ENTRY_SIZE;
+    // a reader may see the count while a writer changes it.
+    // keep a torn count within the node; the reader retries anyway.
+    int count = readInt(buffer);
+    if (count & LEAF_PACKED) {
+        PackedLayout l;
+        return readLayout(buffer, pageSize, l) ? l.count : 0;
     }
-    return count;
+    return (count < 0) ? 0 : (count > capacity) ? capacity : count;
+}
+
+/**
+ * Return the number of keys that fit in the node.
+ * @return the capacity of the node
+ */
+int BTLeafNode::getMaxKeyCount()
+{
+    return isPacked() ? PACKED_CAPACITY(pageSize) : capacity;
+}
+
+/**
+ * Return whether the node is packed.
+ * @return true if the node is packed
+ */
+bool BTLeafNode::isPacked()
+{
+    return (readInt(buffer) & LEAF_PACKED) != 0;
+}
+
+/**
+ * Return the number of keys that fit in a packed node, at best.
+ * @param pageSize[IN] the size of the page holding the node
+ * @return the capacity of a packed node
+ */
+int BTLeafNode::getMaxPackedKeyCount(int pageSize)
+{
+    return PACKED_CAPACITY(pageSize);
 }
 
 /**
@@ -65,7 +404,7 @@ int BTLeafNode::getKeyCount()
 RC BTLeafNode::insert(int key, const RecordId& rid)
 {
     int keyCount = getKeyCount();
-    if (keyCount == LEAF_CAPACITY){
+    if (keyCount >= getMaxKeyCount()){
         return RC_NODE_FULL;
     }
     int eid;
@@ -74,22 +413,25 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
         return RC_INVALID_RID;
     }
 
-    //insert at the end
-    if(eid == keyCount){
-        int insertionPoint = keyCount * LEAF_ENTRY_SIZE;
-        memcpy(buffer+insertionPoint, &key, sizeof(int));
-        memcpy(buffer+insertionPoint+sizeof(int), &rid, sizeof(RecordId));
-    }
-    //insert in the middle
-    else{
-        char temp[PageFile::PAGE_SIZE];
-        std::fill(temp, temp + PageFile::PAGE_SIZE, 0);
-        memcpy(temp, buffer, LEAF_ENTRY_SIZE*(keyCount));
-        memcpy(buffer + (eid+1)*LEAF_ENTRY_SIZE, temp + (eid)*LEAF_ENTRY_SIZE, LEAF_ENTRY_SIZE*(keyCount-eid));
-        memcpy(buffer + (eid)*LEAF_ENTRY_SIZE, &key, sizeof(int));
-        memcpy(buffer + (eid)*LEAF_ENTRY_SIZE + sizeof(int), &rid, sizeof(RecordId));
+    // a packed node is built again with the new entry
+    if (isPacked()) {
+        int keys[MAX_PACKED_CAPACITY+1];
+        RecordId rids[MAX_PACKED_CAPACITY+1];
+        readEntries(keys, rids);
+        memmove(keys + eid + 1, keys + eid, (keyCount-eid)*sizeof(int));
+        memmove(rids + eid + 1, rids + eid, (keyCount-eid)*sizeof(RecordId));
+        keys[eid] = key;
+        rids[eid] = rid;
+        return build(keys, rids, keyCount+1, true);
     }
 
+    // shift the keys and RecordIds behind eid by one and store the new entry
+    memmove(LEAF_KEY(buffer, eid+1), LEAF_KEY(buffer, eid), (keyCount-eid)*sizeof(int));
+    memmove(LEAF_RID(buffer, capacity, eid+1), LEAF_RID(buffer, capacity, eid), (keyCount-eid)*sizeof(RecordId));
+    memcpy(LEAF_KEY(buffer, eid), &key, sizeof(int));
+    memcpy(LEAF_RID(buffer, capacity, eid), &rid, sizeof(RecordId));
+    writeInt(buffer, keyCount+1);
+
     return 0;
 }
 
@@ -103,7 +445,7 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
  * @param siblingKey[OUT] the first key in the sibling node after split.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
+RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
                               BTLeafNode& sibling, int& siblingKey)
 {
     int keyCount = getKeyCount();
@@ -112,46 +454,182 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
     if(locate(key,position) == 0 || keyCount ==0){
         return RC_INVALID_RID;
     }
+    if (sibling.pageSize != pageSize) {
+        sibling.page.unpin();
+        sibling.useLocal(pageSize);
+        std::fill(sibling.buffer, sibling.buffer + pageSize, 0);
+    }
 
-    int firstHalf = keyCount/2;
+    // lay out all keyCount+1 keys and RecordIds in order in temporary arrays
+    int keys[MAX_PACKED_CAPACITY+1];
+    RecordId rids[MAX_PACKED_CAPACITY+1];
+    readEntries(keys, rids);
+    memmove(keys + position + 1, keys + position, (keyCount-position)*sizeof(int));
+    memmove(rids + position + 1, rids + position, (keyCount-position)*sizeof(RecordId));
+    keys[position] = key;
+    rids[position] = rid;
 
-    std::fill(sibling.buffer, sibling.buffer + PageFile::PAGE_SIZE, 0);
-    memcpy(sibling.buffer, this->buffer + firstHalf*LEAF_ENTRY_SIZE, (keyCount-firstHalf)*LEAF_ENTRY_SIZE);
-    std::fill(this->buffer + firstHalf*LEAF_ENTRY_SIZE, this->buffer + PageFile::PAGE_SIZE, 0);
+    return splitEntries(keys, rids, keyCount + 1, sibling, siblingKey);
+}
 
-    // should be inserted in the current node
-    if(position<=firstHalf) {
-        this->insert(key,rid);
-    }else{
-        sibling.insert(key,rid);
+/**
+ * Split the node half and half with sibling without inserting an entry.
+ * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+ * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::split(BTLeafNode& sibling, int& siblingKey)
+{
+    int keyCount = getKeyCount();
+    if (keyCount < 2) {
+        return RC_INVALID_RID;
     }
+    if (sibling.pageSize != pageSize) {
+        sibling.page.unpin();
+        sibling.useLocal(pageSize);
+        std::fill(sibling.buffer, sibling.buffer + pageSize, 0);
+    }
+
+    int keys[MAX_PACKED_CAPACITY];
+    RecordId rids[MAX_PACKED_CAPACITY];
+    readEntries(keys, rids);
+    return splitEntries(keys, rids, keyCount, sibling, siblingKey);
+}
 
-    while ((this->getKeyCount() - sibling.getKeyCount())>1){
-        int tempKey;
-        RecordId tempId;
-        this->readEntry(this->getKeyCount()-1,tempKey,tempId);
-        std::fill(this->buffer + (getKeyCount()-1)*LEAF_ENTRY_SIZE, this->buffer + (this->getKeyCount())*LEAF_ENTRY_SIZE, 0);
-        sibling.insert(tempKey, tempId);
+/*
+ * Store the first half of the count entries in this node and the rest
+ * in sibling. Each half holds at most the entries of a plain node.
+ */
+RC BTLeafNode::splitEntries(const int* keys, const RecordId* rids, int count,
+                            BTLeafNode& sibling, int& siblingKey)
+{
+    RC rc;
+
+    // this node keeps the first half (and the extra entry if odd)
+    int firstHalf = (count + 1) / 2;
+    bool packed = isPacked();
+    if ((rc = sibling.build(keys + firstHalf, rids + firstHalf, count - firstHalf, packed)) < 0 ||
+        (rc = build(keys, rids, firstHalf, packed)) < 0) {
+        return rc;
     }
 
-    while ((this->getKeyCount() - sibling.getKeyCount())<0){
-        int tempKey;
-        RecordId tempId;
-        sibling.readEntry(0,tempKey,tempId);
-        char temp[PageFile::PAGE_SIZE];
-        memcpy(temp, sibling.buffer, PageFile::PAGE_SIZE);
-        std::fill(sibling.buffer, sibling.buffer + PageFile::PAGE_SIZE, 0);
-        memcpy(sibling.buffer, temp + LEAF_ENTRY_SIZE, PageFile::PAGE_SIZE-LEAF_ENTRY_SIZE);
-        this->insert(tempKey,tempId);
+    siblingKey = keys[firstHalf];
+    return 0;
+}
+
+/**
+ * Return whether insert() of the (key, rid) pair succeeds without a split.
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @return true if the pair fits in the node
+ */
+bool BTLeafNode::fits(int key, const RecordId& rid)
+{
+    int keyCount = getKeyCount();
+
+    // a packed node falls back to a plain one if that holds the entries
+    if (keyCount < capacity) {
+        return true;
+    }
+    if (!isPacked() || keyCount + 1 > PACKED_CAPACITY(pageSize)) {
+        return false;
+    }
+
+    LeafRanges ranges;
+    int k;
+    RecordId r;
+    for (int eid = 0; eid < keyCount; eid++) {
+        readEntry(eid, k, r);
+        ranges.add(k, r);
+    }
+    ranges.add(key, rid);
+    return ranges.packedSize(keyCount + 1) <= pageSize;
+}
+
+/**
+ * Replace the entries of the node, keeping its next sibling pointer.
+ * @param keys[IN] the sorted keys of the entries
+ * @param rids[IN] the RecordIds of the entries
+ * @param count[IN] the number of entries
+ * @param packed[IN] true to pack the entries
+ * @return 0 if successful. RC_NODE_FULL if the entries do not fit.
+ */
+RC BTLeafNode::build(const int* keys, const RecordId* rids, int count, bool packed)
+{
+    LeafRanges ranges;
+    for (int i = 0; i < count; i++) {
+        ranges.add(keys[i], rids[i]);
     }
+    packed = packed && count <= PACKED_CAPACITY(pageSize) && ranges.packedSize(count) <= pageSize;
+    if (!packed && count > capacity) {
+        return RC_NODE_FULL;
+    }
+
+    // lay out the node in a temporary page, so that a failure
+    // leaves the node as it was
+    char page[PageFile::MAX_PAGE_SIZE];
+    PageId next = getNextNodePtr();
+    std::fill(page, page + pageSize, 0);
+    memcpy(page + NEXT_PID_OFFSET, &next, sizeof(PageId));
+
+    if (!packed) {
+        writeInt(page, count);
+        memcpy(LEAF_KEY(page, 0), keys, count*sizeof(int));
+        memcpy(LEAF_RID(page, capacity, 0), rids, count*sizeof(RecordId));
+    } else if (count > 0) {
+        int keyBits = bitsFor(ranges.minKey, ranges.maxKey);
+        int pidBits = bitsFor(ranges.minPid, ranges.maxPid);
+        int sidBits = bitsFor(ranges.minSid, ranges.maxSid);
+        writeInt(page, count | LEAF_PACKED);
+        writeInt(page + PACKED_BASE_OFFSET, ranges.minKey);
+        writeInt(page + PACKED_BASE_OFFSET + sizeof(int), ranges.minPid);
+        writeInt(page + PACKED_BASE_OFFSET + 2*sizeof(int), ranges.minSid);
+        page[PACKED_BITS_OFFSET] = (char) keyBits;
+        page[PACKED_BITS_OFFSET + 1] = (char) pidBits;
+        page[PACKED_BITS_OFFSET + 2] = (char) sidBits;
 
-    int sKey;
-    RecordId sRid;
-    sibling.readEntry(0,sKey,sRid);
-    siblingKey = sKey;
+        char* bits = page + PACKED_HEADER_SIZE;
+        long long pidStart = (long long)count * keyBits;
+        long long sidStart = pidStart + (long long)count * pidBits;
+        for (int i = 0; i < count; i++) {
+            writeBits(bits, (long long)i * keyBits, keyBits,
+                      (uint32_t)keys[i] - (uint32_t)ranges.minKey);
+            writeBits(bits, pidStart + (long long)i * pidBits, pidBits,
+                      (uint32_t)rids[i].pid - (uint32_t)ranges.minPid);
+            writeBits(bits, sidStart + (long long)i * sidBits, sidBits,
+                      (uint32_t)rids[i].sid - (uint32_t)ranges.minSid);
+        }
+    } else {
+        writeInt(page, LEAF_PACKED);
+    }
+
+    memcpy(buffer, page, pageSize);
     return 0;
 }
 
+/*
+ * Copy the entries of the node into keys and rids, which have room for
+ * the entries of a packed node. Return the number of entries.
+ */
+int BTLeafNode::readEntries(int* keys, RecordId* rids)
+{
+    int keyCount = getKeyCount();
+    if (!isPacked()) {
+        memcpy(keys, LEAF_KEY(buffer, 0), keyCount*sizeof(int));
+        memcpy(rids, LEAF_RID(buffer, capacity, 0), keyCount*sizeof(RecordId));
+        return keyCount;
+    }
+
+    PackedLayout l;
+    if (!readLayout(buffer, pageSize, l)) {
+        return 0;
+    }
+    for (int eid = 0; eid < l.count; eid++) {
+        readPacked(buffer, l, eid, keys[eid], rids[eid]);
+    }
+    return l.count;
+}
+
 /**
  * If searchKey exists in the node, set eid to the index entry
  * with searchKey and return 0. If not, set eid to the index entry
@@ -165,20 +643,36 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
 {
-    for(int i=0;i<getKeyCount();i++){
-        int key;
-        RecordId recordId;
-        readEntry(i,key,recordId);
-        if (key == searchKey) {
-            eid=i;
-            return 0;
-        }
-        if(key > searchKey){
-            eid = i;
+    // the keys of a packed node are searched as their differences
+    // from the smallest key, without decoding the node
+    if (isPacked()) {
+        PackedLayout l;
+        eid = 0;
+        if (!readLayout(buffer, pageSize, l) || l.count == 0 || searchKey < l.keyBase) {
             return RC_NO_SUCH_RECORD;
         }
+        const char* bits = buffer + PACKED_HEADER_SIZE;
+        uint32_t target = (uint32_t)searchKey - (uint32_t)l.keyBase;
+        int lo = 0;
+        int len = l.count;
+        while (len > 0) {
+            int half = len >> 1;
+            bool smaller = readBits(bits, (long long)(lo + half) * l.keyBits, l.keyBits) < target;
+            lo = smaller ? lo + half + 1 : lo;
+            len = smaller ? len - half - 1 : half;
+        }
+        eid = lo;
+        if (eid < l.count && readBits(bits, (long long)eid * l.keyBits, l.keyBits) == target) {
+            return 0;
+        }
+        return RC_NO_SUCH_RECORD;
+    }
+
+    int keyCount = getKeyCount();
+    eid = countSmaller(LEAF_KEY(buffer, 0), keyCount, searchKey);
+    if (eid < keyCount && readInt(LEAF_KEY(buffer, eid)) == searchKey) {
+        return 0;
     }
-    eid = getKeyCount();
     return RC_NO_SUCH_RECORD;
 }
 
@@ -191,57 +685,85 @@ RC BTLeafNode::locate(int searchKey, int& eid)
  */
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 {
+    if (isPacked()) {
+        PackedLayout l;
+        if (!readLayout(buffer, pageSize, l) || eid >= l.count || eid < 0) {
+            return RC_NO_SUCH_RECORD;
+        }
+        readPacked(buffer, l, eid, key, rid);
+        return 0;
+    }
+
     if(eid>=getKeyCount() || eid<0){
         return RC_NO_SUCH_RECORD;
     }
-    memcpy(&key, buffer + eid*LEAF_ENTRY_SIZE, sizeof(int));
-    memcpy(&rid, buffer + eid*LEAF_ENTRY_SIZE + sizeof(int), sizeof(RecordId));
+    memcpy(&key, LEAF_KEY(buffer, eid), sizeof(int));
+    memcpy(&rid, LEAF_RID(buffer, capacity, eid), sizeof(RecordId));
+    return 0;
+}
+
+/**
+ * Replace the RecordId of the eid entry, keeping its key.
+ * @param eid[IN] the entry number to change
+ * @param rid[IN] the new RecordId of the entry
+ * @return 0 if successful. RC_NODE_FULL if the new RecordId does not
+ *         fit in a packed node, which is then unchanged.
+ */
+RC BTLeafNode::setEntryRid(int eid, const RecordId& rid)
+{
+    if(eid>=getKeyCount() || eid<0){
+        return RC_NO_SUCH_RECORD;
+    }
+
+    // a packed node is built again with the new RecordId
+    if (isPacked()) {
+        int keys[MAX_PACKED_CAPACITY];
+        RecordId rids[MAX_PACKED_CAPACITY];
+        int keyCount = readEntries(keys, rids);
+        rids[eid] = rid;
+        return build(keys, rids, keyCount, true);
+    }
+
+    memcpy(LEAF_RID(buffer, capacity, eid), &rid, sizeof(RecordId));
     return 0;
 }
 
 /**
  * Return the pid of the next slibling node.
- * @return the PageId of the next sibling node 
+ * @return the PageId of the next sibling node
  */
 PageId BTLeafNode::getNextNodePtr()
 {
     PageId pid;
-    memcpy(&pid, buffer+PAGE_ID_OFFSET, sizeof(PageId));
+    memcpy(&pid, buffer+NEXT_PID_OFFSET, sizeof(PageId));
     return pid;
 }
 
 /**
  * Set the pid of the next slibling node.
- * @param pid[IN] the PageId of the next sibling node 
+ * @param pid[IN] the PageId of the next sibling node
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::setNextNodePtr(PageId pid)
 {
-    memcpy(buffer+PAGE_ID_OFFSET,&pid,sizeof(PageId));
+    memcpy(buffer+NEXT_PID_OFFSET,&pid,sizeof(PageId));
     return 0;
 }
 
 void BTLeafNode::print()
 {
-    cout<<"leaf capacity: " << LEAF_CAPACITY <<"\n";
+    cout<<"leaf capacity: " << getMaxKeyCount() << (isPacked() ? " (packed)" : "") <<"\n";
 
     cout<<"key count: " << getKeyCount() <<"\n";
-    char* temp=buffer;
     for(int i=0;i<getKeyCount();i++)
     {
         int key;
-        memcpy(&key,temp,sizeof(int));
+        RecordId rid;
+        readEntry(i, key, rid);
         cout<<"key: "<<key<<endl;
-        temp+=LEAF_ENTRY_SIZE;
     }
 }
 
-bool BTLeafNode::isBlockEmpty(int startingIndex){
-    char emptyBlock [LEAF_ENTRY_SIZE];
-    memset (emptyBlock, 0, sizeof emptyBlock);
-    return !memcmp(buffer + startingIndex, emptyBlock, LEAF_ENTRY_SIZE);
-}
-
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -251,9 +773,50 @@ bool BTLeafNode::isBlockEmpty(int startingIndex){
 
 
 
-BTNonLeafNode::BTNonLeafNode()
+BTNonLeafNode::BTNonLeafNode(int size)
+{
+    localSize = 0;
+    useLocal(size);
+    std::fill(buffer, buffer + pageSize, 0);
+}
+
+/*
+ * Copying a node copies its content into the local buffer of the new node.
+ */
+BTNonLeafNode::BTNonLeafNode(const BTNonLeafNode& other)
+{
+    localSize = 0;
+    useLocal(other.pageSize);
+    memcpy(buffer, other.buffer, pageSize);
+}
+
+BTNonLeafNode& BTNonLeafNode::operator= (const BTNonLeafNode& other)
+{
+    if (this != &other) {
+        // other keeps its own pin, so its content stays valid
+        page.unpin();
+        useLocal(other.pageSize);
+        memcpy(buffer, other.buffer, pageSize);
+    }
+    return *this;
+}
+
+void BTNonLeafNode::setPageSize(int size)
+{
+    pageSize = size;
+    capacity = NON_LEAF_CAPACITY(size);
+}
+
+// lay the node out in the local buffer for pages of the given size.
+// the content of the buffer is undefined afterwards.
+void BTNonLeafNode::useLocal(int size)
 {
-    std::fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
+    if (localSize < size) {
+        local.reset(new char[size]);
+        localSize = size;
+    }
+    buffer = local.get();
+    setPageSize(size);
 }
 
 /**
@@ -264,9 +827,17 @@ BTNonLeafNode::BTNonLeafNode()
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 {
-    return pf.read(pid,buffer);
+    RC rc;
+    PageHandle handle;
+    if ((rc = pf.fetch(pid, handle)) < 0) {
+        return rc;
+    }
+    page = std::move(handle);
+    buffer = page.data();
+    setPageSize(pf.getPageSize());
+    return 0;
 }
-    
+
 /**
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -275,7 +846,28 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 {
-    return pf.write(pid,buffer);
+    // the node was laid out for pages of a different size
+    if (pf.getPageSize() != pageSize) {
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    // the node already lives in the frame of the page
+    if (page.isPinned() && page.file() == &pf && page.pid() == pid) {
+        page.markDirty();
+        return 0;
+    }
+
+    // copy the node into the frame of the page and refer to it from now on
+    RC rc;
+    PageHandle handle;
+    if ((rc = pf.fetchNew(pid, handle)) < 0) {
+        return rc;
+    }
+    memcpy(handle.data(), buffer, pageSize);
+    handle.markDirty();
+    page = std::move(handle);
+    buffer = page.data();
+    return 0;
 }
 
 /**
@@ -284,19 +876,20 @@ RC BTNonLeafNode::write(PageId pid, PageFile& pf)
  */
 int BTNonLeafNode::getKeyCount()
 {
-    int count = 0;
-    int cursor = sizeof(PageId);
-    int lastStartingIndex = (NON_LEAF_CAPACITY-1)*NON_LEAF_ENTRY_SIZE + sizeof(PageId);
-    while(cursor<=lastStartingIndex){
-        if(isBlockEmpty(cursor)){
-            break;
-        }
-        count ++;
-        cursor+=NON_LEAF_ENTRY_SIZE;
-    }
-    return count;
+    // a reader may see the count while a writer changes it.
+    // keep a torn count within the node; the reader retries anyway.
+    int count = readInt(buffer);
+    return (count < 0) ? 0 : (count > capacity) ? capacity : count;
 }
 
+/**
+ * Return the number of keys that fit in the node.
+ * @return the capacity of the node
+ */
+int BTNonLeafNode::getMaxKeyCount()
+{
+    return capacity;
+}
 
 /**
  * Insert a (key, pid) pair to the node.
@@ -307,7 +900,7 @@ int BTNonLeafNode::getKeyCount()
 RC BTNonLeafNode::insert(int key, PageId pid)
 {
     int keyCount = getKeyCount();
-    if (keyCount == NON_LEAF_CAPACITY){
+    if (keyCount == capacity){
         return RC_NODE_FULL;
     }
 
@@ -317,21 +910,13 @@ RC BTNonLeafNode::insert(int key, PageId pid)
         return RC_INVALID_PID;
     }
 
-    //insert at the end
-    if(eid == keyCount){
-        int insertionPoint = keyCount * NON_LEAF_ENTRY_SIZE + sizeof(PageId);
-        memcpy(buffer+insertionPoint, &key, sizeof(int));
-        memcpy(buffer+insertionPoint+sizeof(int), &pid, sizeof(PageId));
-    }
-        //insert in the middle
-    else{
-        char temp[PageFile::PAGE_SIZE];
-        std::fill(temp, temp + PageFile::PAGE_SIZE, 0);
-        memcpy(temp, buffer, NON_LEAF_ENTRY_SIZE*(keyCount) + sizeof(PageId));
-        memcpy(buffer + (eid+1)*NON_LEAF_ENTRY_SIZE+sizeof(PageId), temp + (eid)*NON_LEAF_ENTRY_SIZE+ sizeof(PageId), NON_LEAF_ENTRY_SIZE*(keyCount-eid));
-        memcpy(buffer + (eid)*NON_LEAF_ENTRY_SIZE+sizeof(PageId), &key, sizeof(int));
-        memcpy(buffer + (eid)*NON_LEAF_ENTRY_SIZE+ sizeof(PageId)+sizeof(int), &pid, sizeof(PageId));
-    }
+    // shift the keys behind eid and the children behind eid+1 by one.
+    // pid is the child to the right of key.
+    memmove(NON_LEAF_KEY(buffer, eid+1), NON_LEAF_KEY(buffer, eid), (keyCount-eid)*sizeof(int));
+    memmove(NON_LEAF_PID(buffer, capacity, eid+2), NON_LEAF_PID(buffer, capacity, eid+1), (keyCount-eid)*sizeof(PageId));
+    memcpy(NON_LEAF_KEY(buffer, eid), &key, sizeof(int));
+    memcpy(NON_LEAF_PID(buffer, capacity, eid+1), &pid, sizeof(PageId));
+    writeInt(buffer, keyCount+1);
 
     return 0;
 }
@@ -354,48 +939,77 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
     if(locate(key,position)==0){
         return RC_INVALID_PID;
     }
-    int firstHalf;
-    // the insertion key is the midkey
-    if (position==ceil(keyCount/2) || position==floor(keyCount/2)){
-        firstHalf = ceil(keyCount/2);
-        memcpy(sibling.buffer,&pid, sizeof(PageId));
-        memcpy(sibling.buffer+sizeof(PageId), this->buffer + firstHalf*NON_LEAF_ENTRY_SIZE + sizeof(PageId),
-               (keyCount-firstHalf)*NON_LEAF_ENTRY_SIZE);
-        std::fill(this->buffer + firstHalf*NON_LEAF_ENTRY_SIZE + sizeof(PageId), this->buffer + PageFile::PAGE_SIZE, 0);
-        midKey = key;
-    }
-    //key should be inserted in first half
-    else if(position<floor(keyCount/2)){
-        firstHalf = floor(keyCount/2);
-        memcpy(sibling.buffer+sizeof(PageId), this->buffer + firstHalf*NON_LEAF_ENTRY_SIZE + sizeof(PageId),
-               (keyCount-firstHalf)*NON_LEAF_ENTRY_SIZE);
-        std::fill(this->buffer + firstHalf*NON_LEAF_ENTRY_SIZE + sizeof(PageId), this->buffer + PageFile::PAGE_SIZE, 0);
-        this->insert(key, pid);
-
-        PageId midPid;
-        this->readKeyPid(this->getKeyCount()-1, midKey, midPid);
-        memcpy(sibling.buffer,&midPid, sizeof(PageId));
-        int firstHalfKeyCount = this->getKeyCount();
-        std::fill(this->buffer+(firstHalfKeyCount-1)*NON_LEAF_ENTRY_SIZE+ sizeof(PageId),
-                  this->buffer+firstHalfKeyCount*NON_LEAF_ENTRY_SIZE+ sizeof(PageId), 0);
-    }
-    //key should be inserted in first half
-    //position>ceil(keyCount/2)
-    else{
-        firstHalf = ceil(keyCount/2);
-        memcpy(sibling.buffer+sizeof(PageId), this->buffer + firstHalf*NON_LEAF_ENTRY_SIZE + sizeof(PageId),
-               (keyCount-firstHalf)*NON_LEAF_ENTRY_SIZE);
-        std::fill(this->buffer + firstHalf*NON_LEAF_ENTRY_SIZE + sizeof(PageId), this->buffer + PageFile::PAGE_SIZE, 0);
-        PageId midPid;
-        sibling.insert(key, pid);
-        sibling.readPidKey(0, midPid, midKey);
-        char temp[PageFile::PAGE_SIZE];
-        std::fill(temp, temp + sizeof(PageFile::PAGE_SIZE), 0);
-        memcpy(temp, sibling.buffer + NON_LEAF_ENTRY_SIZE, PageFile::PAGE_SIZE - NON_LEAF_ENTRY_SIZE);
-        memcpy(sibling.buffer,temp, PageFile::PAGE_SIZE);
+    if (sibling.pageSize != pageSize) {
+        sibling.page.unpin();
+        sibling.useLocal(pageSize);
+        std::fill(sibling.buffer, sibling.buffer + pageSize, 0);
+    }
+
+    // lay out all keyCount+1 keys and keyCount+2 children in order
+    // in temporary arrays
+    char keys[(MAX_NON_LEAF_CAPACITY+1)*sizeof(int)];
+    char pids[(MAX_NON_LEAF_CAPACITY+2)*sizeof(PageId)];
+    memcpy(keys, NON_LEAF_KEY(buffer, 0), position*sizeof(int));
+    memcpy(keys + position*sizeof(int), &key, sizeof(int));
+    memcpy(keys + (position+1)*sizeof(int), NON_LEAF_KEY(buffer, position),
+           (keyCount-position)*sizeof(int));
+    memcpy(pids, NON_LEAF_PID(buffer, capacity, 0), (position+1)*sizeof(PageId));
+    memcpy(pids + (position+1)*sizeof(PageId), &pid, sizeof(PageId));
+    memcpy(pids + (position+2)*sizeof(PageId), NON_LEAF_PID(buffer, capacity, position+1),
+           (keyCount-position)*sizeof(PageId));
+
+    // this node keeps the keys before the middle key, the sibling the
+    // keys after it. the middle key moves up to the parent.
+    int total = keyCount + 1;
+    int mid = total / 2;
+    int rest = total - mid - 1;
+
+    std::fill(buffer, buffer + pageSize, 0);
+    writeInt(buffer, mid);
+    memcpy(NON_LEAF_KEY(buffer, 0), keys, mid*sizeof(int));
+    memcpy(NON_LEAF_PID(buffer, capacity, 0), pids, (mid+1)*sizeof(PageId));
+
+    midKey = readInt(keys + mid*sizeof(int));
+
+    // the child to the right of the middle key becomes pid0 of the sibling
+    writeInt(sibling.buffer, rest);
+    memcpy(NON_LEAF_KEY(sibling.buffer, 0), keys + (mid+1)*sizeof(int), rest*sizeof(int));
+    memcpy(NON_LEAF_PID(sibling.buffer, capacity, 0), pids + (mid+1)*sizeof(PageId), (rest+1)*sizeof(PageId));
+
+    return 0;
+}
+
+/**
+ * Split the node half and half with sibling without inserting a key.
+ * The middle key moves up and is returned in midKey.
+ * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+ * @param midKey[OUT] the key in the middle before the split. This key should be inserted to the parent node.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::split(BTNonLeafNode& sibling, int& midKey)
+{
+    int keyCount = getKeyCount();
+    if (keyCount < 2) {
+        return RC_INVALID_PID;
+    }
+    if (sibling.pageSize != pageSize) {
+        sibling.page.unpin();
+        sibling.useLocal(pageSize);
+        std::fill(sibling.buffer, sibling.buffer + pageSize, 0);
     }
 
+    // the sibling takes the keys after the middle key and the children
+    // to the right of it. this node keeps the rest.
+    int mid = keyCount / 2;
+    int rest = keyCount - mid - 1;
+    midKey = readInt(NON_LEAF_KEY(buffer, mid));
+
+    writeInt(sibling.buffer, rest);
+    memcpy(NON_LEAF_KEY(sibling.buffer, 0), NON_LEAF_KEY(buffer, mid+1), rest*sizeof(int));
+    memcpy(NON_LEAF_PID(sibling.buffer, capacity, 0), NON_LEAF_PID(buffer, capacity, mid+1),
+           (rest+1)*sizeof(PageId));
 
+    writeInt(buffer, mid);
     return 0;
 }
 
@@ -408,16 +1022,10 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
  */
 RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 {
-    int keyCount = getKeyCount();
-    for(int i=0;i<keyCount;i++){
-        PageId currentPid;
-        int currentKey;
-        readPidKey(i,currentPid,currentKey);
-        if(searchKey<=currentKey){
-            pid = currentPid;
-        }
-    }
-    memcpy(&pid, buffer+keyCount*NON_LEAF_ENTRY_SIZE, sizeof(PageId));
+    // the child to the left of the first key larger than searchKey
+    // holds searchKey. keys equal to a separator live in its right child.
+    int eid = countNotLarger(NON_LEAF_KEY(buffer, 0), getKeyCount(), searchKey);
+    memcpy(&pid, NON_LEAF_PID(buffer, capacity, eid), sizeof(PageId));
     return 0;
 }
 
@@ -434,20 +1042,11 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
  */
 RC BTNonLeafNode::locate(int searchKey, int& eid)
 {
-    for(int i=0;i<getKeyCount();i++){
-        int key;
-        PageId pageId;
-        readPidKey(i,pageId,key);
-        if (key == searchKey) {
-            eid=i;
-            return 0;
-        }
-        if(key > searchKey){
-            eid = i;
-            return RC_NO_SUCH_RECORD;
-        }
+    int keyCount = getKeyCount();
+    eid = countSmaller(NON_LEAF_KEY(buffer, 0), keyCount, searchKey);
+    if (eid < keyCount && readInt(NON_LEAF_KEY(buffer, eid)) == searchKey) {
+        return 0;
     }
-    eid = getKeyCount();
     return RC_NO_SUCH_RECORD;
 }
 
@@ -456,8 +1055,8 @@ RC BTNonLeafNode::readKeyPid(int eid, int& key, PageId& pid)
     if(eid>=getKeyCount() || eid<0){
         return RC_NO_SUCH_RECORD;
     }
-    memcpy(&key, buffer + eid*NON_LEAF_ENTRY_SIZE+sizeof(PageId), sizeof(int));
-    memcpy(&pid, buffer + (eid+1)*NON_LEAF_ENTRY_SIZE, sizeof(PageId));
+    memcpy(&key, NON_LEAF_KEY(buffer, eid), sizeof(int));
+    memcpy(&pid, NON_LEAF_PID(buffer, capacity, eid+1), sizeof(PageId));
     return 0;
 }
 
@@ -466,8 +1065,8 @@ RC BTNonLeafNode::readPidKey(int eid, PageId& pid, int& key)
     if(eid>=getKeyCount() || eid<0){
         return RC_NO_SUCH_RECORD;
     }
-    memcpy(&pid, buffer + eid*NON_LEAF_ENTRY_SIZE, sizeof(PageId));
-    memcpy(&key, buffer + eid*NON_LEAF_ENTRY_SIZE+sizeof(PageId), sizeof(int));
+    memcpy(&pid, NON_LEAF_PID(buffer, capacity, eid), sizeof(PageId));
+    memcpy(&key, NON_LEAF_KEY(buffer, eid), sizeof(int));
     return 0;
 }
 /**
@@ -479,19 +1078,14 @@ RC BTNonLeafNode::readPidKey(int eid, PageId& pid, int& key)
  */
 RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
 {
-    std::fill(buffer, buffer + PageFile::PAGE_SIZE, 0);
-    memcpy(buffer, &pid1, sizeof(PageId));
-    memcpy(buffer + sizeof(PageId), &key, sizeof(int));
-    memcpy(buffer + NON_LEAF_ENTRY_SIZE, &pid2, sizeof(PageId));
+    std::fill(buffer, buffer + pageSize, 0);
+    writeInt(buffer, 1);
+    memcpy(NON_LEAF_PID(buffer, capacity, 0), &pid1, sizeof(PageId));
+    memcpy(NON_LEAF_KEY(buffer, 0), &key, sizeof(int));
+    memcpy(NON_LEAF_PID(buffer, capacity, 1), &pid2, sizeof(PageId));
     return 0;
 }
 
-bool BTNonLeafNode::isBlockEmpty(int startingIndex){
-    char emptyBlock [NON_LEAF_ENTRY_SIZE];
-    memset (emptyBlock, 0, sizeof emptyBlock);
-    return !memcmp(buffer + startingIndex, emptyBlock, NON_LEAF_ENTRY_SIZE);
-}
-
 void BTNonLeafNode::print()
 {
     cout<<"key count: " << getKeyCount() <<"\n";
@@ -499,7 +1093,6 @@ void BTNonLeafNode::print()
     int key;
     PageId pid;
 
-    char* temp=buffer;
     readPidKey(0,pid,key);
     cout<<"pid: " <<pid <<endl;
     for(int i=0;i<getKeyCount();i++)
@@ -507,7 +1100,393 @@ void BTNonLeafNode::print()
         readKeyPid(i,key,pid);
         cout<<"key: "<<key<<endl;
         cout<<"pid: "<<pid<<endl;
-        temp+=NON_LEAF_ENTRY_SIZE;
     }
     cout<<"----------------------"<<endl;
-}
\ No newline at end of file
+}
+
+//
+// A string node starts with the key count, a PageId and the offset where
+// the entries begin, followed by the offsets of the entries in key order.
+// An entry is the length of its key, the payload and the bytes of the key.
+//
+#define STR_PID_OFFSET          (sizeof(int))
+#define STR_START_OFFSET        (sizeof(int) + sizeof(PageId))
+#define STR_HEADER_SIZE         (2*sizeof(int) + sizeof(PageId))
+#define STR_SLOT(buf, eid)      ((buf) + STR_HEADER_SIZE + (eid)*sizeof(int))
+#define STR_ENTRY_SIZE(payload, length) ((int)(sizeof(int) + (payload) + (length)))
+
+BTStringNode::BTStringNode(int size, int payload)
+    : buffer(new char[size]()), pageSize(size), payloadSize(payload)
+{
+    writeInt(buffer.get() + STR_PID_OFFSET, -1);
+    writeInt(buffer.get() + STR_START_OFFSET, pageSize);
+}
+
+/*
+ * Return the longest key a node stores.
+ * @param pageSize[IN] the size of the page holding the node
+ * @return the longest key in bytes
+ */
+int BTStringNode::getMaxKeyLength(int pageSize)
+{
+    return pageSize / 8;
+}
+
+/*
+ * Read the content of the node from the page pid in the PageFile pf.
+ * A page whose entries do not lie within it is not a node.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::read(PageId pid, const PageFile& pf)
+{
+    RC rc;
+    if (pf.getPageSize() != pageSize) {
+        pageSize = pf.getPageSize();
+        buffer.reset(new char[pageSize]);
+    }
+    if ((rc = pf.read(pid, buffer.get())) < 0) {
+        return rc;
+    }
+
+    char* buf = buffer.get();
+    int count = readInt(buf);
+    int start = readInt(buf + STR_START_OFFSET);
+    if (count < 0 || (int)(STR_HEADER_SIZE + count*sizeof(int)) > start || start > pageSize) {
+        return RC_INVALID_FILE_FORMAT;
+    }
+    for (int eid = 0; eid < count; eid++) {
+        int offset = readInt(STR_SLOT(buf, eid));
+        if (offset < start || offset > pageSize - STR_ENTRY_SIZE(payloadSize, 0) ||
+            readInt(buf + offset) < 0 ||
+            readInt(buf + offset) > pageSize - offset - STR_ENTRY_SIZE(payloadSize, 0)) {
+            return RC_INVALID_FILE_FORMAT;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write the content of the node to the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to write to
+ * @param pf[IN] PageFile to write to
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNode::write(PageId pid, PageFile& pf)
+{
+    return pf.write(pid, buffer.get());
+}
+
+/*
+ * Return the number of keys stored in the node.
+ * @return the number of keys in the node
+ */
+int BTStringNode::getKeyCount() const
+{
+    return readInt(buffer.get());
+}
+
+/*
+ * Return the key of the eid entry.
+ * @param eid[IN] the entry number
+ * @return the key of the entry
+ */
+string_view BTStringNode::getKey(int eid) const
+{
+    const char* entry = buffer.get() + readInt(STR_SLOT(buffer.get(), eid));
+    return string_view(entry + sizeof(int) + payloadSize, readInt(entry));
+}
+
+PageId BTStringNode::getHeaderPid() const
+{
+    return readInt(buffer.get() + STR_PID_OFFSET);
+}
+
+void BTStringNode::setHeaderPid(PageId pid)
+{
+    writeInt(buffer.get() + STR_PID_OFFSET, pid);
+}
+
+const char* BTStringNode::getPayload(int eid) const
+{
+    return buffer.get() + readInt(STR_SLOT(buffer.get(), eid)) + sizeof(int);
+}
+
+// whether an entry with a key of keyLength bytes and its offset fit
+bool BTStringNode::fits(size_t keyLength) const
+{
+    int free = readInt(buffer.get() + STR_START_OFFSET) -
+               (int)(STR_HEADER_SIZE + (getKeyCount() + 1)*sizeof(int));
+    return free >= STR_ENTRY_SIZE(payloadSize, keyLength);
+}
+
+// place an entry in front of the others and make it the eid'th.
+// the caller checked that it fits.
+void BTStringNode::insertAt(int eid, string_view key, const void* payload)
+{
+    char* buf = buffer.get();
+    int count = getKeyCount();
+    int start = readInt(buf + STR_START_OFFSET) - STR_ENTRY_SIZE(payloadSize, key.size());
+
+    writeInt(buf + start, key.size());
+    memcpy(buf + start + sizeof(int), payload, payloadSize);
+    memcpy(buf + start + sizeof(int) + payloadSize, key.data(), key.size());
+
+    memmove(STR_SLOT(buf, eid + 1), STR_SLOT(buf, eid), (count - eid)*sizeof(int));
+    writeInt(STR_SLOT(buf, eid), start);
+    writeInt(buf + STR_START_OFFSET, start);
+    writeInt(buf, count + 1);
+}
+
+int BTStringNode::lowerBound(string_view key) const
+{
+    int lo = 0, hi = getKeyCount();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (getKey(mid) < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int BTStringNode::upperBound(string_view key) const
+{
+    int lo = 0, hi = getKeyCount();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (getKey(mid) <= key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// copy the entries out of the node, in key order
+void BTStringNode::readEntries(vector<Entry>& entries) const
+{
+    int count = getKeyCount();
+    entries.resize(count);
+    for (int eid = 0; eid < count; eid++) {
+        entries[eid].key = getKey(eid);
+        memcpy(entries[eid].payload, getPayload(eid), payloadSize);
+    }
+}
+
+// replace the entries of the node, keeping the PageId of the header
+void BTStringNode::build(const Entry* entries, int count)
+{
+    writeInt(buffer.get(), 0);
+    writeInt(buffer.get() + STR_START_OFFSET, pageSize);
+    for (int eid = 0; eid < count; eid++) {
+        insertAt(eid, entries[eid].key, entries[eid].payload);
+    }
+}
+
+// the first entry of the right half when the entries are split about
+// half and half by the bytes they take. both halves get an entry.
+int BTStringNode::splitPoint(const vector<Entry>& entries) const
+{
+    int total = 0;
+    for (unsigned i = 0; i < entries.size(); i++) {
+        total += STR_ENTRY_SIZE(payloadSize, entries[i].key.size()) + sizeof(int);
+    }
+    int n = entries.size();
+    int left = 0;
+    int m = 0;
+    while (m < n - 1 && left < total / 2) {
+        left += STR_ENTRY_SIZE(payloadSize, entries[m].key.size()) + sizeof(int);
+        m++;
+    }
+    return max(m, 1);
+}
+
+/*
+ * The shortest prefix of right that is larger than left, or right itself
+ * if the two are equal. left must not be larger than right.
+ */
+static string shortestSeparator(string_view left, string_view right)
+{
+    size_t n = 0;
+    while (n < left.size() && n < right.size() && left[n] == right[n]) {
+        n++;
+    }
+    return string(right.substr(0, min(n + 1, right.size())));
+}
+
+BTStringLeafNode::BTStringLeafNode(int size)
+    : BTStringNode(size, sizeof(RecordId))
+{
+}
+
+/*
+ * Insert the (key, rid) pair to the node behind the entries with the same key.
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @return 0 if successful. RC_NODE_FULL if the node is full.
+ */
+RC BTStringLeafNode::insert(string_view key, const RecordId& rid)
+{
+    if (!fits(key.size())) {
+        return RC_NODE_FULL;
+    }
+    insertAt(upperBound(key), key, &rid);
+    return 0;
+}
+
+/*
+ * Insert the (key, rid) pair to the node and split the node with sibling.
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+ * @param separator[OUT] the key to insert to the parent for the sibling
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringLeafNode::insertAndSplit(string_view key, const RecordId& rid,
+                                    BTStringLeafNode& sibling, string& separator)
+{
+    vector<Entry> entries;
+    Entry entry;
+    int eid = upperBound(key);
+    readEntries(entries);
+    entry.key = key;
+    memcpy(entry.payload, &rid, sizeof(RecordId));
+    entries.insert(entries.begin() + eid, entry);
+
+    int m = splitPoint(entries);
+    sibling.build(entries.data() + m, entries.size() - m);
+    build(entries.data(), m);
+    separator = shortestSeparator(entries[m - 1].key, entries[m].key);
+    return 0;
+}
+
+/*
+ * Set eid to the first entry whose key is not smaller than searchKey.
+ * @param searchKey[IN] the key to search for
+ * @param eid[OUT] the entry number
+ * @return 0 if the entry has searchKey. If not, RC_NO_SUCH_RECORD.
+ */
+RC BTStringLeafNode::locate(string_view searchKey, int& eid)
+{
+    eid = lowerBound(searchKey);
+    return (eid < getKeyCount() && getKey(eid) == searchKey) ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Read the (key, rid) pair from the eid entry.
+ * @param eid[IN] the entry number to read the (key, rid) pair from
+ * @param key[OUT] the key from the entry
+ * @param rid[OUT] the RecordId from the entry
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringLeafNode::readEntry(int eid, string& key, RecordId& rid)
+{
+    if (eid < 0 || eid >= getKeyCount()) {
+        return RC_INVALID_CURSOR;
+    }
+    key = getKey(eid);
+    memcpy(&rid, getPayload(eid), sizeof(RecordId));
+    return 0;
+}
+
+PageId BTStringLeafNode::getNextNodePtr()
+{
+    return getHeaderPid();
+}
+
+RC BTStringLeafNode::setNextNodePtr(PageId pid)
+{
+    setHeaderPid(pid);
+    return 0;
+}
+
+BTStringNonLeafNode::BTStringNonLeafNode(int size)
+    : BTStringNode(size, sizeof(PageId))
+{
+}
+
+/*
+ * Insert the (key, pid) pair to the node behind the child eid.
+ * @param eid[IN] the child whose new right sibling pid is
+ * @param key[IN] the separator of the child and pid
+ * @param pid[IN] the PageId to insert
+ * @return 0 if successful. RC_NODE_FULL if the node is full.
+ */
+RC BTStringNonLeafNode::insert(int eid, string_view key, PageId pid)
+{
+    if (eid < 0 || eid > getKeyCount()) {
+        return RC_INVALID_CURSOR;
+    }
+    if (!fits(key.size())) {
+        return RC_NODE_FULL;
+    }
+    insertAt(eid, key, &pid);
+    return 0;
+}
+
+/*
+ * Insert the (key, pid) pair to the node behind the child eid and split
+ * the node with sibling.
+ * @param eid[IN] the child whose new right sibling pid is
+ * @param key[IN] the separator of the child and pid
+ * @param pid[IN] the PageId to insert
+ * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+ * @param midKey[OUT] the key to insert to the parent for the sibling
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNonLeafNode::insertAndSplit(int eid, string_view key, PageId pid,
+                                       BTStringNonLeafNode& sibling, string& midKey)
+{
+    if (eid < 0 || eid > getKeyCount()) {
+        return RC_INVALID_CURSOR;
+    }
+    vector<Entry> entries;
+    Entry entry;
+    readEntries(entries);
+    entry.key = key;
+    memcpy(entry.payload, &pid, sizeof(PageId));
+    entries.insert(entries.begin() + eid, entry);
+
+    // the middle key moves up. its child becomes the first child
+    // of the sibling.
+    int m = splitPoint(entries);
+    PageId first;
+    memcpy(&first, entries[m].payload, sizeof(PageId));
+    sibling.setHeaderPid(first);
+    sibling.build(entries.data() + m + 1, entries.size() - m - 1);
+    build(entries.data(), m);
+    midKey = entries[m].key;
+    return 0;
+}
+
+/*
+ * Find the child to follow for searchKey.
+ * @param searchKey[IN] the key being looked up
+ * @param eid[OUT] the position of the child. 0 for the first child
+ * @param pid[OUT] the child
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNonLeafNode::locateChildPtr(string_view searchKey, int& eid, PageId& pid)
+{
+    eid = lowerBound(searchKey);
+    if (eid == 0) {
+        pid = getHeaderPid();
+    } else {
+        memcpy(&pid, getPayload(eid - 1), sizeof(PageId));
+    }
+    return 0;
+}
+
+/*
+ * Initialize the root node with (pid1, key, pid2).
+ * @param pid1[IN] the first PageId to insert
+ * @param key[IN] the key that should be inserted between the two PageIds
+ * @param pid2[IN] the PageId to insert behind the key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTStringNonLeafNode::initializeRoot(PageId pid1, string_view key, PageId pid2)
+{
+    setHeaderPid(pid1);
+    build(NULL, 0);
+    insertAt(0, key, &pid2);
+    return 0;
+}
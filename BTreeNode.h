@@ -10,15 +10,53 @@
 #ifndef BTREENODE_H
 #define BTREENODE_H
 
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "RecordFile.h"
 #include "PageFile.h"
 
+/**
+ * The smallest and the largest key, page id and slot number of a set of
+ * leaf entries. They decide how many bits an entry takes in a packed leaf.
+ */
+struct LeafRanges {
+    int    minKey, maxKey;
+    PageId minPid, maxPid;
+    int    minSid, maxSid;
+
+    LeafRanges();
+
+    /**
+     * Extend the ranges by the (key, rid) pair of an entry.
+     */
+    void add(int key, const RecordId& rid);
+
+    /**
+     * Return the bytes taken by a packed leaf of count entries within the ranges.
+     */
+    int packedSize(int count) const;
+};
+
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
+ * The page starts with the key count and the next sibling pointer,
+ * so the keys can be binary searched without scanning the page.
+ * A leaf is either plain, with raw keys and RecordIds, or packed, with
+ * the keys and RecordIds bit-packed against the smallest ones of the node.
+ * A packed leaf holds up to twice as many entries as a plain one.
  */
 class BTLeafNode {
   public:
-    BTLeafNode();
+   /**
+    * Create an empty node laid out for pages of the given size.
+    * A node read from a PageFile takes the page size of the file.
+    * @param pageSize[IN] the size of the page the node is stored in
+    */
+    explicit BTLeafNode(int pageSize = PageFile::PAGE_SIZE);
+    BTLeafNode(const BTLeafNode& other);
+    BTLeafNode& operator= (const BTLeafNode& other);
 
     /**
         * Insert the (key, rid) pair to the node.
@@ -42,6 +80,35 @@ class BTLeafNode {
     */
     RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
 
+   /**
+    * Split the node half and half with sibling without inserting an entry.
+    * The halves of a packed node stay packed if they fit.
+    * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+    * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC split(BTLeafNode& sibling, int& siblingKey);
+
+   /**
+    * Return whether insert() of the (key, rid) pair succeeds without a split.
+    * @param key[IN] the key to insert
+    * @param rid[IN] the RecordId to insert
+    * @return true if the pair fits in the node
+    */
+    bool fits(int key, const RecordId& rid);
+
+   /**
+    * Replace the entries of the node, keeping its next sibling pointer.
+    * The node is packed if packed is true and the entries fit in a packed
+    * node, and plain otherwise.
+    * @param keys[IN] the sorted keys of the entries
+    * @param rids[IN] the RecordIds of the entries
+    * @param count[IN] the number of entries
+    * @param packed[IN] true to pack the entries
+    * @return 0 if successful. RC_NODE_FULL if the entries do not fit.
+    */
+    RC build(const int* keys, const RecordId* rids, int count, bool packed);
+
    /**
     * If searchKey exists in the node, set eid to the index entry
     * with searchKey and return 0. If not, set eid to the index entry
@@ -64,6 +131,15 @@ class BTLeafNode {
     */
     RC readEntry(int eid, int& key, RecordId& rid);
 
+   /**
+    * Replace the RecordId of the eid entry, keeping its key.
+    * @param eid[IN] the entry number to change
+    * @param rid[IN] the new RecordId of the entry
+    * @return 0 if successful. RC_NODE_FULL if the new RecordId does not
+    *         fit in a packed node, which is then unchanged.
+    */
+    RC setEntryRid(int eid, const RecordId& rid);
+
    /**
     * Return the pid of the next slibling node.
     * @return the PageId of the next sibling node 
@@ -83,9 +159,29 @@ class BTLeafNode {
     * @return the number of keys in the node
     */
     int getKeyCount();
+
+   /**
+    * Return the number of keys that fit in the node.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount();
+
+   /**
+    * Return whether the node is packed.
+    * @return true if the node is packed
+    */
+    bool isPacked();
+
+   /**
+    * Return the number of keys that fit in a packed node, at best.
+    * @param pageSize[IN] the size of the page holding the node
+    * @return the capacity of a packed node
+    */
+    static int getMaxPackedKeyCount(int pageSize);
  
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The page stays pinned in the buffer pool while the node refers to it.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
@@ -104,20 +200,43 @@ class BTLeafNode {
 
 private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. After read() it points directly into the
+    * buffer pool frame pinned by page; otherwise it points to local,
+    * which holds a page of the size of the node.
+    * Modifications are made in place, and write() marks the frame dirty
+    * so that the pool writes it back to the disk.
     */
-    char buffer[PageFile::PAGE_SIZE];
-    bool isBlockEmpty(int startingIndex);
+    char* buffer;
+    PageHandle page;
+    std::unique_ptr<char[]> local;
+    int localSize;     // the size of local
+
+    int pageSize;      // the size of the page holding the node
+    int capacity;      // the # of keys that fit in the page
+    void setPageSize(int size);
+    void useLocal(int size);
+
+    int readEntries(int* keys, RecordId* rids);
+    RC splitEntries(const int* keys, const RecordId* rids, int count,
+                    BTLeafNode& sibling, int& siblingKey);
 };
 
 
 /**
  * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ * The page starts with the key count, followed by the child pointers
+ * and the keys in between.
  */
 class BTNonLeafNode {
   public:
-    BTNonLeafNode();
+   /**
+    * Create an empty node laid out for pages of the given size.
+    * A node read from a PageFile takes the page size of the file.
+    * @param pageSize[IN] the size of the page the node is stored in
+    */
+    explicit BTNonLeafNode(int pageSize = PageFile::PAGE_SIZE);
+    BTNonLeafNode(const BTNonLeafNode& other);
+    BTNonLeafNode& operator= (const BTNonLeafNode& other);
     /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -141,6 +260,15 @@ class BTNonLeafNode {
     */
     RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
 
+   /**
+    * Split the node half and half with sibling without inserting a key.
+    * The middle key moves up and is returned in midKey.
+    * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+    * @param midKey[OUT] the key in the middle before the split. This key should be inserted to the parent node.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC split(BTNonLeafNode& sibling, int& midKey);
+
    /**
     * Given the searchKey, find the child-node pointer to follow and
     * output it in pid.
@@ -166,8 +294,15 @@ class BTNonLeafNode {
     */
     int getKeyCount();
 
+   /**
+    * Return the number of keys that fit in the node.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount();
+
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The page stays pinned in the buffer pool while the node refers to it.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
@@ -192,11 +327,228 @@ class BTNonLeafNode {
 
 private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. After read() it points directly into the
+    * buffer pool frame pinned by page; otherwise it points to local,
+    * which holds a page of the size of the node.
+    * Modifications are made in place, and write() marks the frame dirty
+    * so that the pool writes it back to the disk.
+    */
+    char* buffer;
+    PageHandle page;
+    std::unique_ptr<char[]> local;
+    int localSize;     // the size of local
+
+    int pageSize;      // the size of the page holding the node
+    int capacity;      // the # of keys that fit in the page
+    void setPageSize(int size);
+    void useLocal(int size);
+};
+
+/**
+ * BTStringNode: The part shared by the nodes of a B+tree on strings.
+ * The node is a slotted page. It starts with the key count, a PageId
+ * (the next sibling of a leaf, the first child of a non-leaf) and the
+ * offset where the entries begin, followed by the offsets of the entries
+ * in key order. The entries are placed from the end of the page towards
+ * the offsets. An entry holds the length of its key, a fixed-size
+ * payload (the RecordId of a leaf entry, the child behind the key of a
+ * non-leaf entry) and the bytes of the key. Keys are compared bytewise.
+ */
+class BTStringNode {
+  public:
+   /**
+    * Return the number of keys stored in the node.
+    * @return the number of keys in the node
+    */
+    int getKeyCount() const;
+
+   /**
+    * Return the key of the eid entry. It stays valid until the node changes.
+    * @param eid[IN] the entry number
+    * @return the key of the entry
+    */
+    std::string_view getKey(int eid) const;
+
+   /**
+    * Return the longest key a node stores, so that every node holds
+    * several entries. A longer value is stored as its prefix of that
+    * length, which keeps the order of the values.
+    * @param pageSize[IN] the size of the page holding the node
+    * @return the longest key in bytes
+    */
+    static int getMaxKeyLength(int pageSize);
+
+   /**
+    * Read the content of the node from the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Write the content of the node to the page pid in the PageFile pf.
+    * @param pid[IN] the PageId to write to
+    * @param pf[IN] PageFile to write to
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC write(PageId pid, PageFile& pf);
+
+  protected:
+   /**
+    * @param pageSize[IN] the size of the page the node is stored in
+    * @param payloadSize[IN] the size of the payload of an entry
+    */
+    BTStringNode(int pageSize, int payloadSize);
+
+    // an entry taken out of a node while it is split
+    struct Entry {
+        std::string key;
+        char payload[sizeof(RecordId)];
+    };
+
+    PageId getHeaderPid() const;
+    void setHeaderPid(PageId pid);
+    const char* getPayload(int eid) const;
+    bool fits(size_t keyLength) const;
+    void insertAt(int eid, std::string_view key, const void* payload);
+    int lowerBound(std::string_view key) const;  // the first entry not smaller than key
+    int upperBound(std::string_view key) const;  // the first entry larger than key
+    void readEntries(std::vector<Entry>& entries) const;
+    void build(const Entry* entries, int count);
+    int splitPoint(const std::vector<Entry>& entries) const;
+
+    std::unique_ptr<char[]> buffer;  // the content of the node
+    int pageSize;     // the size of the page holding the node
+    int payloadSize;  // the size of the payload of an entry
+};
+
+/**
+ * BTStringLeafNode: The leaf node of a B+tree on strings, holding
+ * (key, RecordId) entries. A key may appear in several entries, which
+ * stay in insertion order.
+ */
+class BTStringLeafNode : public BTStringNode {
+  public:
+   /**
+    * Create an empty node laid out for pages of the given size.
+    * @param pageSize[IN] the size of the page the node is stored in
+    */
+    explicit BTStringLeafNode(int pageSize = PageFile::PAGE_SIZE);
+
+   /**
+    * Insert the (key, rid) pair to the node behind the entries with the
+    * same key.
+    * @param key[IN] the key to insert. at most getMaxKeyLength() bytes
+    * @param rid[IN] the RecordId to insert
+    * @return 0 if successful. RC_NODE_FULL if the node is full.
+    */
+    RC insert(std::string_view key, const RecordId& rid);
+
+   /**
+    * Insert the (key, rid) pair to the node and split the node about
+    * half and half by bytes with sibling. The separator is the shortest
+    * prefix of the first key of the sibling that is larger than the last
+    * key left in the node, or that key itself if the two are equal.
+    * @param key[IN] the key to insert
+    * @param rid[IN] the RecordId to insert
+    * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+    * @param separator[OUT] the key to insert to the parent for the sibling
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC insertAndSplit(std::string_view key, const RecordId& rid, BTStringLeafNode& sibling,
+                      std::string& separator);
+
+   /**
+    * Set eid to the first entry whose key is not smaller than searchKey,
+    * or to the key count if there is none.
+    * @param searchKey[IN] the key to search for
+    * @param eid[OUT] the entry number
+    * @return 0 if the entry has searchKey. If not, RC_NO_SUCH_RECORD.
+    */
+    RC locate(std::string_view searchKey, int& eid);
+
+   /**
+    * Read the (key, rid) pair from the eid entry.
+    * @param eid[IN] the entry number to read the (key, rid) pair from
+    * @param key[OUT] the key from the entry
+    * @param rid[OUT] the RecordId from the entry
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntry(int eid, std::string& key, RecordId& rid);
+
+   /**
+    * Return the pid of the next slibling node.
+    * @return the PageId of the next sibling node. -1 for the last leaf
+    */
+    PageId getNextNodePtr();
+
+   /**
+    * Set the next slibling node PageId.
+    * @param pid[IN] the PageId of the next sibling node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setNextNodePtr(PageId pid);
+};
+
+/**
+ * BTStringNonLeafNode: The non-leaf node of a B+tree on strings. The keys
+ * are separators: every key of the i'th child is not larger than the
+ * i'th key, which is not larger than any key of the (i+1)'th child. Since
+ * a key may appear in several leaves, a child is found for a key by the
+ * separators smaller than it, which leads to the leftmost leaf that may
+ * hold it, and a new child is inserted by the position of the child it
+ * was split from rather than by its key.
+ */
+class BTStringNonLeafNode : public BTStringNode {
+  public:
+   /**
+    * Create an empty node laid out for pages of the given size.
+    * @param pageSize[IN] the size of the page the node is stored in
+    */
+    explicit BTStringNonLeafNode(int pageSize = PageFile::PAGE_SIZE);
+
+   /**
+    * Insert the (key, pid) pair to the node behind the child eid.
+    * @param eid[IN] the child whose new right sibling pid is
+    * @param key[IN] the separator of the child and pid
+    * @param pid[IN] the PageId to insert
+    * @return 0 if successful. RC_NODE_FULL if the node is full.
+    */
+    RC insert(int eid, std::string_view key, PageId pid);
+
+   /**
+    * Insert the (key, pid) pair to the node behind the child eid and split
+    * the node about half and half by bytes with sibling. The key in the
+    * middle moves up and is returned in midKey.
+    * @param eid[IN] the child whose new right sibling pid is
+    * @param key[IN] the separator of the child and pid
+    * @param pid[IN] the PageId to insert
+    * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+    * @param midKey[OUT] the key to insert to the parent for the sibling
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC insertAndSplit(int eid, std::string_view key, PageId pid, BTStringNonLeafNode& sibling,
+                      std::string& midKey);
+
+   /**
+    * Find the child to follow for searchKey: the one behind the last key
+    * smaller than searchKey, or the first child if there is none.
+    * @param searchKey[IN] the key being looked up
+    * @param eid[OUT] the position of the child. 0 for the first child
+    * @param pid[OUT] the child
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildPtr(std::string_view searchKey, int& eid, PageId& pid);
+
+   /**
+    * Initialize the root node with (pid1, key, pid2).
+    * @param pid1[IN] the first PageId to insert
+    * @param key[IN] the key that should be inserted between the two PageIds
+    * @param pid2[IN] the PageId to insert behind the key
+    * @return 0 if successful. Return an error code if there is an error.
     */
-    char buffer[PageFile::PAGE_SIZE];
-    bool isBlockEmpty(int startingIndex);
+    RC initializeRoot(PageId pid1, std::string_view key, PageId pid2);
 };
 
 #endif /* BTREENODE_H */
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "BufferPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/stat.h>
+
+BufferPool::BufferPool(int frameCount, int pageSize, Policy policy)
+{
+  if (frameCount < MIN_FRAME_COUNT) frameCount = MIN_FRAME_COUNT;
+
+  this->frameCount = frameCount;
+  this->pageSize = pageSize;
+  this->policy = policy;
+  data = new char[(size_t)frameCount * pageSize];
+  frames.resize(frameCount);
+  for (int i = 0; i < frameCount; i++) clearFrame(i);
+  table.reserve(frameCount);
+  clockHand = 0;
+  accessClock = 0;
+}
+
+BufferPool::~BufferPool()
+{
+  delete [] data;
+}
+
+// size the pool and pick the policy from the environment
+static BufferPool* createInstance(int pageSize)
+{
+  double mb = BufferPool::DEFAULT_BUFFER_MB;
+  const char* s = getenv("BRUINBASE_BUFFER_MB");
+  if (s != NULL && atof(s) > 0) mb = atof(s);
+
+  BufferPool::Policy policy = BufferPool::LRU_K;
+  s = getenv("BRUINBASE_BUFFER_POLICY");
+  if (s != NULL && strcasecmp(s, "clock") == 0) policy = BufferPool::CLOCK;
+
+  return new BufferPool((int)(mb * 1024 * 1024 / pageSize), pageSize, policy);
+}
+
+BufferPool& BufferPool::getInstance(int pageSize)
+{
+  // one pool per power-of-two page size, created on first use
+  static const int POOL_COUNT = 8;
+  static std::mutex mutex;
+  static BufferPool* pools[POOL_COUNT];
+
+  int n = 0;
+  while (n < POOL_COUNT - 1 && (PageFile::MIN_PAGE_SIZE << n) < pageSize) n++;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (pools[n] == NULL) pools[n] = createInstance(PageFile::MIN_PAGE_SIZE << n);
+  return *pools[n];
+}
+
+RC BufferPool::openFile(int fd, bool writable, int& file)
+{
+  struct stat statbuf;
+
+  if (::fstat(fd, &statbuf) < 0) return RC_FILE_OPEN_FAILED;
+
+  std::lock_guard<std::mutex> lock(latch);
+
+  // another open of the same file shares its number
+  int unused = -1;
+  for (int i = 0; i < (int) files.size(); i++) {
+    if (files[i].opens == 0) {
+      if (unused < 0) unused = i;
+      continue;
+    }
+    if (files[i].dev == statbuf.st_dev && files[i].ino == statbuf.st_ino) {
+      if (writable || files[i].writable) return RC_FILE_OPEN_FAILED;
+      files[i].opens++;
+      file = i;
+      return 0;
+    }
+  }
+
+  if (unused < 0) {
+    unused = files.size();
+    files.resize(unused + 1);
+  }
+  files[unused].dev = statbuf.st_dev;
+  files[unused].ino = statbuf.st_ino;
+  files[unused].fd = writable ? fd : -1;
+  files[unused].opens = 1;
+  files[unused].writable = writable;
+  file = unused;
+  return 0;
+}
+
+RC BufferPool::closeFile(int file)
+{
+  RC rc = 0;
+  RC wrc;
+  std::unique_lock<std::mutex> lock(latch);
+
+  // wait until no page of the file is being read or written back.
+  // look at all frames again after each wait.
+  for (int i = 0; i < frameCount; i++) {
+    if (frames[i].valid && frames[i].file == file && frames[i].loading) {
+      loaded.wait(lock);
+      i = -1;
+    }
+  }
+
+  // only a file open for writing has dirty pages, and it is open only once
+  bool last = (--files[file].opens == 0);
+  for (int i = 0; i < frameCount; i++) {
+    if (!frames[i].valid || frames[i].file != file) continue;
+    if (frames[i].dirty) {
+      if ((wrc = PageFile::writePage(files[file].fd, frames[i].offset, getFrameData(i), pageSize)) < 0) {
+        rc = wrc;
+      }
+      frames[i].dirty = false;
+    }
+    if (!last) continue;
+
+    // a pinned frame stays with its holder until it is unpinned
+    table.erase(frameKey(file, frames[i].pid));
+    if (frames[i].pinCount > 0) {
+      frames[i].file = -1;
+    } else {
+      clearFrame(i);
+    }
+  }
+  return rc;
+}
+
+RC BufferPool::pin(int file, PageId pid, off_t offset, int& frame, bool& hit)
+{
+  RC rc;
+  std::unique_lock<std::mutex> lock(latch);
+
+  for (;;) {
+    // if the page is cached, simply pin its frame.
+    // if another thread is reading the page, wait until it is done.
+    std::unordered_map<long long, int>::iterator it;
+    if ((it = table.find(frameKey(file, pid))) != table.end()) {
+      int f = it->second;
+      if (frames[f].loading) {
+        loaded.wait(lock);
+        continue;
+      }
+      frames[f].pinCount++;
+      touch(f);
+      frame = f;
+      hit = true;
+      return 0;
+    }
+
+    int f = chooseVictim();
+    if (f < 0) return RC_BUFFER_FULL;
+
+    // write back the evicted page if it was modified. the latch is not
+    // held during the write: the frame is marked as loading, so that it
+    // is not chosen again and readers of its page wait as for a read.
+    // the page may be cached by another thread meanwhile, so look again.
+    if (frames[f].valid && frames[f].dirty) {
+      int fd = files[frames[f].file].fd;
+      frames[f].loading = true;
+      lock.unlock();
+      rc = PageFile::writePage(fd, frames[f].offset, getFrameData(f), pageSize);
+      lock.lock();
+      frames[f].loading = false;
+      loaded.notify_all();
+      if (rc < 0) return rc;
+      frames[f].dirty = false;
+      continue;
+    }
+
+    if (frames[f].valid) table.erase(frameKey(frames[f].file, frames[f].pid));
+    clearFrame(f);
+
+    frames[f].file = file;
+    frames[f].pid = pid;
+    frames[f].offset = offset;
+    frames[f].valid = true;
+    frames[f].loading = true;
+    frames[f].pinCount = 1;
+    table[frameKey(file, pid)] = f;
+    touch(f);
+
+    frame = f;
+    hit = false;
+    return 0;
+  }
+}
+
+void BufferPool::ready(int frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  frames[frame].loading = false;
+  loaded.notify_all();
+}
+
+void BufferPool::unpin(int frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  if (frames[frame].pinCount > 0) frames[frame].pinCount--;
+
+  // the file was closed while the frame was pinned
+  if (frames[frame].pinCount == 0 && frames[frame].valid && frames[frame].file < 0) {
+    clearFrame(frame);
+  }
+}
+
+void BufferPool::markDirty(int frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  frames[frame].dirty = true;
+}
+
+void BufferPool::discard(int frame)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  if (frames[frame].valid && frames[frame].file >= 0) {
+    table.erase(frameKey(frames[frame].file, frames[frame].pid));
+  }
+  clearFrame(frame);
+  loaded.notify_all();
+}
+
+void BufferPool::touch(int f)
+{
+  Frame& frame = frames[f];
+
+  frame.referenced = true;
+
+  // shift the access history and record the current time
+  memmove(frame.history + 1, frame.history, sizeof(long long) * (HISTORY_LENGTH - 1));
+  frame.history[0] = ++accessClock;
+}
+
+int BufferPool::chooseVictim()
+{
+  return (policy == CLOCK) ? clockVictim() : lruKVictim();
+}
+
+int BufferPool::clockVictim()
+{
+  // sweep the frames, giving a second chance to the referenced ones.
+  // an unpinned frame is found within two rounds if there is any.
+  for (int n = 0; n < 2 * frameCount; n++) {
+    int f = clockHand;
+    clockHand = (clockHand + 1) % frameCount;
+
+    if (!frames[f].valid) return f;
+    if (frames[f].pinCount > 0 || frames[f].loading) continue;
+    if (!frames[f].referenced) return f;
+    frames[f].referenced = false;
+  }
+  return -1;
+}
+
+int BufferPool::lruKVictim()
+{
+  // evict the frame whose K-th most recent access is the oldest.
+  // frames accessed fewer than K times have an infinite backward
+  // K-distance and go first, in LRU order of their last access.
+  int victim = -1;
+  for (int i = 0; i < frameCount; i++) {
+    if (!frames[i].valid) return i;
+    if (frames[i].pinCount > 0 || frames[i].loading) continue;
+    if (victim < 0) { victim = i; continue; }
+
+    const long long* h = frames[i].history;
+    const long long* v = frames[victim].history;
+    if (h[HISTORY_LENGTH-1] < v[HISTORY_LENGTH-1] ||
+        (h[HISTORY_LENGTH-1] == v[HISTORY_LENGTH-1] && h[0] < v[0])) {
+      victim = i;
+    }
+  }
+  return victim;
+}
+
+void BufferPool::clearFrame(int f)
+{
+  frames[f].file = -1;
+  frames[f].pid = -1;
+  frames[f].offset = 0;
+  frames[f].valid = false;
+  frames[f].dirty = false;
+  frames[f].referenced = false;
+  frames[f].loading = false;
+  frames[f].pinCount = 0;
+  memset(frames[f].history, 0, sizeof(frames[f].history));
+}
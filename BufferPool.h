@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * The buffer pool shared by all PageFiles of the process with the same
+ * page size. There is one pool for each page size in use.
+ * A frame is located through a hash table keyed by (file, pid) and
+ * replaced either by the CLOCK or by the LRU-K policy. A file is known to
+ * the pool by its identity (device and inode), so every PageFile opened
+ * on the same file shares its cached pages. A file opened for writing
+ * cannot be opened again until it is closed, so the dirty pages of a file
+ * are never hidden from another PageFile of the same file. Pinned frames are
+ * never replaced, and dirty frames are written back before replacement.
+ * The page table and the frame states are protected by a latch, so the
+ * pool may be used by several threads at the same time. The latch is not
+ * held while a missing page is read from the disk; other threads asking
+ * for the same page wait until the reading thread calls ready(). Neither
+ * is it held while a dirty victim is written back.
+ * The size of the pool is read from the environment when the pool is
+ * first used:
+ *   BRUINBASE_BUFFER_MB     - size of each pool in megabytes (default 4)
+ *   BRUINBASE_BUFFER_POLICY - "clock" or "lru-k" (default "lru-k")
+ */
+class BufferPool {
+ public:
+
+  enum Policy { CLOCK, LRU_K };
+
+  static const int DEFAULT_BUFFER_MB = 4;  // default size of the pool
+  static const int MIN_FRAME_COUNT = 16;   // the pool never gets smaller
+  static const int HISTORY_LENGTH = 2;     // K of the LRU-K policy
+
+  /**
+   * create a pool with the given number of frames and replacement policy.
+   * @param frameCount[IN] the number of page frames in the pool
+   * @param pageSize[IN] the size of a page frame
+   * @param policy[IN] the replacement policy
+   */
+  BufferPool(int frameCount, int pageSize, Policy policy);
+  ~BufferPool();
+
+  /**
+   * @param pageSize[IN] a page size supported by PageFile
+   * @return the process-wide pool for pages of the size
+   */
+  static BufferPool& getInstance(int pageSize);
+
+  /**
+   * register an open file with the pool.
+   * @param fd[IN] the file descriptor of the open file
+   * @param writable[IN] true if the file is opened for writing
+   * @param file[OUT] the number of the file in the pool
+   * @return error code. 0 if no error. RC_FILE_OPEN_FAILED if the file
+   *         is already open for writing, or if it is opened for writing
+   *         while it is already open
+   */
+  RC openFile(int fd, bool writable, int& file);
+
+  /**
+   * write back all dirty pages of a file and unregister one open of it.
+   * when the last open is closed, the pages of the file are dropped from
+   * the pool. a frame that is still pinned then is dropped when it is
+   * unpinned.
+   * @param file[IN] the number of the file returned by openFile()
+   * @return error code. 0 if no error
+   */
+  RC closeFile(int file);
+
+  /**
+   * pin a page in the pool. if the page is not cached, a victim frame
+   * chosen by the replacement policy is assigned to it and hit is set
+   * to false; the caller must then fill the frame and call ready()
+   * (or discard() it).
+   * @param file[IN] the number of the file the page belongs to
+   * @param pid[IN] the page to pin
+   * @param offset[IN] the position of the page in the file
+   * @param frame[OUT] the frame holding the page
+   * @param hit[OUT] true if the page was already cached
+   * @return error code. 0 if no error
+   */
+  RC pin(int file, PageId pid, off_t offset, int& frame, bool& hit);
+
+  /**
+   * announce that a frame returned by pin() with hit == false is filled.
+   * @param frame[IN] the filled frame
+   */
+  void ready(int frame);
+
+  /**
+   * release a pin obtained by pin().
+   * @param frame[IN] the frame to unpin
+   */
+  void unpin(int frame);
+
+  /**
+   * mark a pinned frame as modified.
+   * @param frame[IN] the frame to mark
+   */
+  void markDirty(int frame);
+
+  /**
+   * unpin a frame and drop its page from the pool without writing it back.
+   * used when the frame could not be filled.
+   * @param frame[IN] the frame to discard
+   */
+  void discard(int frame);
+
+  /**
+   * @param frame[IN] a frame of the pool
+   * @return pointer to the page data held by the frame
+   */
+  char* getFrameData(int frame) { return data + (size_t)frame * pageSize; }
+
+  /**
+   * @return the number of frames in the pool
+   */
+  int getFrameCount() const { return frameCount; }
+
+  /**
+   * @return the size of a page frame
+   */
+  int getPageSize() const { return pageSize; }
+
+ private:
+  struct OpenFile {
+    dev_t     dev;             // the identity of the file
+    ino_t     ino;
+    int       fd;              // a file descriptor to write back pages with
+    int       opens;           // # of PageFiles open on the file. 0 if unused
+    bool      writable;        // true if the file is open for writing
+  };
+
+  struct Frame {
+    int       file;            // file of the cached page. -1 if the file
+                               //   was closed while the frame was pinned
+    PageId    pid;             // page id of the cached page
+    off_t     offset;          // position of the page in the file
+    bool      valid;           // false if the frame is empty
+    bool      dirty;           // true if the page must be written back
+    bool      referenced;      // reference bit of the CLOCK policy
+    bool      loading;         // true while the page is read from the disk
+                               //   or written back to it
+    int       pinCount;        // # of handles pinning the frame
+    long long history[HISTORY_LENGTH];  // last K access times, most recent first
+                                        //   (0 means "never accessed")
+  };
+
+  static long long frameKey(int file, PageId pid)
+    { return ((long long)file << 32) | (unsigned int)pid; }
+
+  void touch(int f);         // record an access to frame f
+  int  chooseVictim();       // pick an unused frame to replace. -1 if none
+  int  clockVictim();
+  int  lruKVictim();
+  void clearFrame(int f);
+
+  int    frameCount;
+  int    pageSize;
+  Policy policy;
+  char*  data;                 // frameCount * pageSize bytes of page data
+  std::vector<Frame> frames;
+  std::vector<OpenFile> files;  // the open files by their number
+  std::unordered_map<long long, int> table;  // (file, pid) -> frame
+  int       clockHand;         // next frame examined by CLOCK
+  long long accessClock;       // logical time for LRU-K
+
+  std::mutex latch;            // protects all of the above but the page data
+  std::condition_variable loaded;  // signaled when a frame stops loading
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "KeySorter.h"
+#include <algorithm>
+
+using std::vector;
+
+// # of entries read from a run at a time during the merge
+static const size_t RUN_BLOCK_ENTRIES = 4096;
+
+KeySorter::KeySorter(size_t memoryBudget)
+{
+  maxEntries = memoryBudget / sizeof(Entry);
+  if (maxEntries < RUN_BLOCK_ENTRIES) maxEntries = RUN_BLOCK_ENTRIES;
+  pos = 0;
+}
+
+KeySorter::~KeySorter()
+{
+  for (unsigned i = 0; i < runs.size(); i++) {
+    fclose(runs[i].file);
+  }
+}
+
+RC KeySorter::add(int key, const RecordId& rid)
+{
+  RC rc;
+
+  // spill the buffer as a sorted run when the budget is used up
+  if (buffer.size() >= maxEntries && (rc = writeRun()) < 0) return rc;
+
+  Entry e;
+  e.key = key;
+  e.rid = rid;
+  buffer.push_back(e);
+  return 0;
+}
+
+RC KeySorter::writeRun()
+{
+  Run run;
+
+  std::stable_sort(buffer.begin(), buffer.end(), entryLess);
+
+  // the temporary file is removed automatically when it is closed
+  run.file = tmpfile();
+  if (run.file == NULL) return RC_FILE_OPEN_FAILED;
+  if (fwrite(buffer.data(), sizeof(Entry), buffer.size(), run.file) != buffer.size()) {
+    fclose(run.file);
+    return RC_FILE_WRITE_FAILED;
+  }
+  rewind(run.file);
+  run.pos = 0;
+  runs.push_back(run);
+
+  buffer.clear();
+  return 0;
+}
+
+RC KeySorter::fillBlock(Run& run)
+{
+  run.block.resize(RUN_BLOCK_ENTRIES);
+  size_t n = fread(run.block.data(), sizeof(Entry), RUN_BLOCK_ENTRIES, run.file);
+  if (n == 0 && ferror(run.file)) return RC_FILE_READ_FAILED;
+  run.block.resize(n);
+  run.pos = 0;
+  return 0;
+}
+
+RC KeySorter::sort()
+{
+  RC rc;
+
+  // everything fits in memory. just sort the buffer.
+  if (runs.empty()) {
+    std::stable_sort(buffer.begin(), buffer.end(), entryLess);
+    pos = 0;
+    return 0;
+  }
+
+  // otherwise write the rest as the last run and merge all runs
+  if (!buffer.empty() && (rc = writeRun()) < 0) return rc;
+  vector<Entry>().swap(buffer);
+
+  heap.clear();
+  for (unsigned i = 0; i < runs.size(); i++) {
+    if ((rc = fillBlock(runs[i])) < 0) return rc;
+    if (!runs[i].block.empty()) heap.push_back(i);
+  }
+  std::make_heap(heap.begin(), heap.end(), RunGreater(runs));
+  return 0;
+}
+
+RC KeySorter::next(int& key, RecordId& rid)
+{
+  RC rc;
+
+  if (runs.empty()) {
+    if (pos >= buffer.size()) return RC_END_OF_FILE;
+    key = buffer[pos].key;
+    rid = buffer[pos].rid;
+    pos++;
+    return 0;
+  }
+
+  // take the smallest current entry among the runs
+  if (heap.empty()) return RC_END_OF_FILE;
+  std::pop_heap(heap.begin(), heap.end(), RunGreater(runs));
+  Run& run = runs[heap.back()];
+  key = run.block[run.pos].key;
+  rid = run.block[run.pos].rid;
+
+  // advance the run and put it back unless it is exhausted
+  if (++run.pos >= run.block.size() && (rc = fillBlock(run)) < 0) return rc;
+  if (run.block.empty()) {
+    heap.pop_back();
+  } else {
+    std::push_heap(heap.begin(), heap.end(), RunGreater(runs));
+  }
+  return 0;
+}
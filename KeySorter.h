@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYSORTER_H
+#define KEYSORTER_H
+
+#include <cstdio>
+#include <vector>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+
+/**
+ * Sorts (key, RecordId) pairs by key for bulk loading an index.
+ * Pairs are kept in memory up to a memory budget. Beyond that, each full
+ * buffer is sorted and written to a temporary file as a sorted run, and
+ * the runs are merged when the pairs are read back.
+ */
+class KeySorter {
+ public:
+
+  static const int DEFAULT_SORT_MB = 64;  // default memory budget
+
+  /**
+   * @param memoryBudget[IN] the # of bytes of pairs kept in memory
+   */
+  KeySorter(size_t memoryBudget);
+  ~KeySorter();
+
+  /**
+   * add a pair to sort. must not be called after sort().
+   * @param key[IN] the key of the pair
+   * @param rid[IN] the RecordId of the pair
+   * @return error code. 0 if no error
+   */
+  RC add(int key, const RecordId& rid);
+
+  /**
+   * finish adding pairs and prepare to read them back in key order.
+   * @return error code. 0 if no error
+   */
+  RC sort();
+
+  /**
+   * read the next pair in key order.
+   * @param key[OUT] the key of the pair
+   * @param rid[OUT] the RecordId of the pair
+   * @return error code. RC_END_OF_FILE if all pairs have been read
+   */
+  RC next(int& key, RecordId& rid);
+
+ private:
+  struct Entry {
+    int      key;
+    RecordId rid;
+  };
+
+  // a sorted run in a temporary file, read back one block at a time
+  struct Run {
+    FILE* file;
+    std::vector<Entry> block;
+    size_t pos;
+  };
+
+  static bool entryLess(const Entry& a, const Entry& b) { return a.key < b.key; }
+
+  // orders the heap so that the run with the smallest current key is on top.
+  // equal keys come from the earlier run first, since the runs are written
+  // in the order the pairs were added, so the merge is stable.
+  struct RunGreater {
+    const std::vector<Run>& runs;
+    RunGreater(const std::vector<Run>& r) : runs(r) { }
+    bool operator() (int a, int b) const {
+      int ka = runs[a].block[runs[a].pos].key;
+      int kb = runs[b].block[runs[b].pos].key;
+      return ka > kb || (ka == kb && a > b);
+    }
+  };
+
+  RC writeRun();           // sort the buffer and write it out as a run
+  RC fillBlock(Run& run);  // read the next block of a run
+
+  size_t maxEntries;             // # of entries that fit in the budget
+  std::vector<Entry> buffer;     // the unsorted pairs in memory
+  size_t pos;                    // next entry of buffer to return
+  std::vector<Run> runs;         // the sorted runs on disk
+  std::vector<int> heap;         // heap of runs by their current key
+};
+
+#endif // KEYSORTER_H
@@ -9,28 +9,107 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "BufferPool.h"
 #include <cstring>
+#include <cstdlib>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cerrno>
 
 using std::string;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+std::atomic<int> PageFile::readCount(0);
+std::atomic<int> PageFile::writeCount(0);
+
+//
+// the header at the beginning of a file. the rest of the header page
+// is zero. the header takes up one page so that pages stay aligned.
+//
+struct FileHeader {
+  char magic[8];      // HEADER_MAGIC
+  int  version;       // HEADER_VERSION
+  int  pageSize;      // the size of a page of the file
+};
+
+static const char HEADER_MAGIC[8] = { 'B', 'R', 'U', 'I', 'N', 'P', 'G', '\0' };
+static const int  HEADER_VERSION = 1;
+
+// read size bytes at offset. a read returning fewer bytes is continued,
+// and the part beyond the end of the file is zeroed.
+static RC readFully(int fd, void* buffer, size_t size, off_t offset)
+{
+  char* p = (char*) buffer;
+  while (size > 0) {
+    ssize_t n = ::pread(fd, p, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_READ_FAILED;
+    }
+    if (n == 0) {
+      memset(p, 0, size);
+      break;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+// write size bytes at offset. a write taking fewer bytes is continued.
+static RC writeFully(int fd, const void* buffer, size_t size, off_t offset)
+{
+  const char* p = (const char*) buffer;
+  while (size > 0) {
+    ssize_t n = ::pwrite(fd, p, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_WRITE_FAILED;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+// check whether size is a supported page size
+static bool validPageSize(int size)
+{
+  return size >= PageFile::MIN_PAGE_SIZE && size <= PageFile::MAX_PAGE_SIZE &&
+         (size & (size - 1)) == 0;
+}
+
+// the page size of new files, taken from the environment
+static int newPageSize()
+{
+  const char* s = getenv("BRUINBASE_PAGE_SIZE");
+  if (s != NULL && validPageSize(atoi(s))) return atoi(s);
+  return PageFile::DEFAULT_PAGE_SIZE;
+}
 
 PageFile::PageFile() 
 { 
   fd = -1; 
   epid = 0; 
+  pageSize = PAGE_SIZE;
+  base = 0;
+  pool = NULL;
+  poolFile = -1;
+  map = NULL;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
   epid = 0;
+  pageSize = PAGE_SIZE;
+  base = 0;
+  pool = NULL;
+  poolFile = -1;
+  map = NULL;
   open(filename.c_str(), mode);
 }
 
@@ -60,34 +139,97 @@ RC PageFile::open(const string& filename, char mode)
   fd = ::open(filename.c_str(), oflag, 0644);
   if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
 
-  // get the size of the file to set the end pid
+  // get the size of the file to find the page size and set the end pid
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+  if ((rc = readHeader(statbuf.st_size, oflag != O_RDONLY)) < 0) {
+    ::close(fd);
+    fd = -1;
+    return rc;
+  }
+  epid = (statbuf.st_size > base) ? (statbuf.st_size - base) / pageSize : 0;
+  pool = &BufferPool::getInstance(pageSize);
+  if ((rc = pool->openFile(fd, oflag != O_RDONLY, poolFile)) < 0) {
+    ::close(fd);
+    fd = -1;
+    pool = NULL;
+    return rc;
+  }
+
+  // map a read-only file into memory. if the mapping fails,
+  // pages are read through the buffer pool as usual.
+  const char* env = getenv("BRUINBASE_MMAP");
+  if (oflag == O_RDONLY && epid > 0 && (env == NULL || atoi(env) != 0)) {
+    void* addr = ::mmap(NULL, pageOffset(epid), PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      map = (char*) addr;
+      touched.reset(new std::atomic<bool>[epid]());
+    }
+  }
+
+  return 0;
+}
+
+RC PageFile::readHeader(off_t fileSize, bool create)
+{
+  FileHeader header;
 
+  // an empty file opened for writing becomes a new file with a header
+  if (fileSize == 0 && create) {
+    pageSize = newPageSize();
+    base = pageSize;
+
+    char* page = new char[pageSize];
+    memset(page, 0, pageSize);
+    memcpy(header.magic, HEADER_MAGIC, sizeof(header.magic));
+    header.version = HEADER_VERSION;
+    header.pageSize = pageSize;
+    memcpy(page, &header, sizeof(header));
+    RC rc = writeFully(fd, page, pageSize, 0);
+    delete [] page;
+    return rc;
+  }
+
+  // a file that does not start with the header is a legacy file
+  pageSize = PAGE_SIZE;
+  base = 0;
+  if (fileSize < (off_t)sizeof(header)) return 0;
+  if (readFully(fd, &header, sizeof(header), 0) < 0) return RC_FILE_READ_FAILED;
+  if (memcmp(header.magic, HEADER_MAGIC, sizeof(header.magic)) != 0) return 0;
+
+  if (header.version != HEADER_VERSION || !validPageSize(header.pageSize)) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+  pageSize = header.pageSize;
+  base = pageSize;
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+  // write back the dirty pages of this file and evict all its cached pages
+  rc = pool->closeFile(poolFile);
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // unmap a read-only file
+  if (map != NULL) {
+    ::munmap(map, pageOffset(epid));
+    map = NULL;
+    touched.reset();
   }
 
+  // close the file
+  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
   epid = 0;
-  return 0;
+  pool = NULL;
+  poolFile = -1;
+  return rc;
 }
 
 PageId PageFile::endPid() const 
@@ -95,86 +237,217 @@ PageId PageFile::endPid() const
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::write(PageId pid, const void* buffer)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  RC rc;
+  PageHandle handle;
+
+  // overwrite the page in the buffer pool. it is written to the disk
+  // when it is evicted or when the file is closed.
+  if ((rc = fetchNew(pid, handle)) < 0) return rc;
+  memcpy(handle.data(), buffer, pageSize);
+  handle.markDirty();
+
+  return 0;
 }
 
-RC PageFile::write(PageId pid, const void* buffer)
+RC PageFile::read(PageId pid, void* buffer) const
 {
   RC rc;
+  PageHandle handle;
+
+  if ((rc = fetch(pid, handle)) < 0) return rc;
+  memcpy(buffer, handle.data(), pageSize);
+
+  return 0;
+}
+
+RC PageFile::fetch(PageId pid, PageHandle& handle) const
+{
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  return pin(pid, true, handle);
+}
+
+RC PageFile::fetchNew(PageId pid, PageHandle& handle)
+{
+  RC rc;
+
   if (pid < 0) return RC_INVALID_PID; 
+  if (map != NULL) return RC_INVALID_FILE_MODE;
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  if ((rc = pin(pid, false, handle)) < 0) return rc;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
-
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
-    }
+  // if the written pid >= end pid, update the end pid
+  PageId end = epid.load();
+  while (pid >= end && !epid.compare_exchange_weak(end, pid + 1)) { }
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, bool fill, PageHandle& handle) const
+{
+  RC   rc;
+  int  frame;
+  bool hit;
+
+  handle.unpin();
+
+  // a page of a mapped file is simply a pointer into the mapping
+  if (map != NULL) {
+    if (!touched[pid].exchange(true)) readCount++;
+    handle.pf = this;
+    handle.pool = NULL;
+    handle.frame = -1;
+    handle.ptr = map + pageOffset(pid);
+    handle.pageId = pid;
+    return 0;
   }
 
-  // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  if ((rc = pool->pin(poolFile, pid, pageOffset(pid), frame, hit)) < 0) return rc;
 
-  // increase page write count
-  writeCount++;
+  char* data = pool->getFrameData(frame);
+  if (!hit) {
+    if (fill) {
+      // read the page from the disk into the frame
+      if (readFully(fd, data, pageSize, pageOffset(pid)) < 0) {
+        pool->discard(frame);
+        return RC_FILE_READ_FAILED;
+      }
+
+      // increase the page read count
+      readCount++;
+    } else {
+      memset(data, 0, pageSize);
+    }
+
+    // let other threads waiting for the page use the frame
+    pool->ready(frame);
+  }
+
+  handle.pf = this;
+  handle.pool = pool;
+  handle.frame = frame;
+  handle.ptr = data;
+  handle.pageId = pid;
 
   return 0;
 }
 
-RC PageFile::read(PageId pid, void* buffer) const
+RC PageFile::advise(AccessPattern pattern) const
 {
-  RC rc;
+  int advice;
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
+  if (map != NULL) {
+    switch (pattern) {
+    case SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+    case RANDOM:     advice = MADV_RANDOM; break;
+    default:         advice = MADV_NORMAL; break;
     }
+    if (::madvise(map, pageOffset(epid), advice) < 0) return RC_FILE_READ_FAILED;
+  } else {
+    switch (pattern) {
+    case SEQUENTIAL: advice = POSIX_FADV_SEQUENTIAL; break;
+    case RANDOM:     advice = POSIX_FADV_RANDOM; break;
+    default:         advice = POSIX_FADV_NORMAL; break;
+    }
+    if (::posix_fadvise(fd, 0, 0, advice) != 0) return RC_FILE_READ_FAILED;
   }
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  return 0;
+}
+
+RC PageFile::prefetch(PageId pid, int count) const
+{
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+  if (count > epid - pid) count = epid - pid;
+
+  if (map != NULL) {
+    // madvise() wants an address aligned to the page size of the system
+    off_t start = pageOffset(pid);
+    off_t aligned = start & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+    if (::madvise(map + aligned, start - aligned + (size_t)count * pageSize, MADV_WILLNEED) < 0) {
+      return RC_FILE_READ_FAILED;
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+  } else {
+    if (::posix_fadvise(fd, pageOffset(pid), (off_t)count * pageSize, POSIX_FADV_WILLNEED) != 0) {
+      return RC_FILE_READ_FAILED;
     }
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
-  }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
 
-  // increase the page read count
-  readCount++;
+  return 0;
+}
+
+RC PageFile::writePage(int fd, off_t offset, const void* buffer, int size)
+{
+  RC rc;
+
+  // write the buffer to the disk page
+  if ((rc = writeFully(fd, buffer, size, offset)) < 0) return rc;
+
+  // increase page write count
+  writeCount++;
 
   return 0;
 }
+
+
+PageHandle::PageHandle()
+{
+  pf = NULL;
+  pool = NULL;
+  frame = -1;
+  ptr = NULL;
+  pageId = -1;
+}
+
+PageHandle::PageHandle(PageHandle&& other)
+{
+  pf = other.pf;
+  pool = other.pool;
+  frame = other.frame;
+  ptr = other.ptr;
+  pageId = other.pageId;
+  other.ptr = NULL;
+  other.pf = NULL;
+}
+
+PageHandle& PageHandle::operator= (PageHandle&& other)
+{
+  if (this != &other) {
+    unpin();
+    pf = other.pf;
+    pool = other.pool;
+    frame = other.frame;
+    ptr = other.ptr;
+    pageId = other.pageId;
+    other.ptr = NULL;
+    other.pf = NULL;
+  }
+  return *this;
+}
+
+PageHandle::~PageHandle()
+{
+  unpin();
+}
+
+void PageHandle::markDirty()
+{
+  if (ptr != NULL && frame >= 0) pool->markDirty(frame);
+}
+
+void PageHandle::unpin()
+{
+  if (ptr == NULL) return;
+
+  if (frame >= 0) pool->unpin(frame);
+  pf = NULL;
+  pool = NULL;
+  frame = -1;
+  ptr = NULL;
+  pageId = -1;
+}
@@ -11,17 +11,96 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <atomic>
+#include <memory>
+#include <sys/types.h>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
+class PageFile;
+class BufferPool;
+
 /**
- * read/write a file in the unit of a page
+ * A page of a PageFile pinned in the buffer pool.
+ * data() points directly into the pool frame holding the page, so no copy
+ * is made. The frame stays valid until unpin() is called or the handle is
+ * destroyed. Call markDirty() after modifying the page; dirty pages are
+ * written back when they are evicted or when the file is closed.
+ */
+class PageHandle {
+ public:
+  PageHandle();
+  PageHandle(PageHandle&& other);
+  PageHandle& operator= (PageHandle&& other);
+  PageHandle(const PageHandle&) = delete;      // handles are not copyable
+  PageHandle& operator= (const PageHandle&) = delete;
+  ~PageHandle();
+
+  /**
+   * @return pointer to the page content in the pool. NULL if not pinned
+   */
+  char* data() const { return ptr; }
+
+  /**
+   * @return the id of the pinned page
+   */
+  PageId pid() const { return pageId; }
+
+  /**
+   * @return the PageFile the pinned page belongs to. NULL if not pinned
+   */
+  const PageFile* file() const { return pf; }
+
+  /**
+   * @return true if the handle currently pins a page
+   */
+  bool isPinned() const { return ptr != NULL; }
+
+  /**
+   * mark the page as modified so that it is written back to the disk.
+   */
+  void markDirty();
+
+  /**
+   * release the page. the page content must not be accessed afterwards.
+   */
+  void unpin();
+
+ private:
+  friend class PageFile;
+  const PageFile* pf;  // the file of the pinned page
+  BufferPool* pool;    // the pool holding the frame. NULL if mapped
+  int     frame;       // the pool frame holding the page (-1 if mapped)
+  char*   ptr;         // the content of the page
+  PageId  pageId;      // the id of the pinned page
+};
+
+/**
+ * read/write a file in the unit of a page.
+ * the page size is a property of each file. a new file starts with a
+ * header page recording its page size, and page 0 is the page after the
+ * header. a file without the header is a legacy file of 1KB pages.
+ * the page size of new files is read from the environment variable
+ * BRUINBASE_PAGE_SIZE (in bytes, default 4096).
+ * a file opened in 'r' mode is memory-mapped and its pages are served
+ * directly from the mapping instead of the buffer pool. set the
+ * environment variable BRUINBASE_MMAP to 0 to disable the mapping.
+ * pages are read and written with positional I/O, so several threads
+ * may read pages of the same PageFile at the same time.
+ * a file may be opened by several PageFiles for reading, but a file open
+ * for writing may not be opened again until it is closed.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int PAGE_SIZE = 1024;          // the page size of legacy files
+  static const int MIN_PAGE_SIZE = 1024;      // the supported page sizes are
+  static const int MAX_PAGE_SIZE = 16384;     //   powers of two in this range
+  static const int DEFAULT_PAGE_SIZE = 4096;  // the default for new files
+
+  // expected page access pattern, see advise()
+  enum AccessPattern { NORMAL, SEQUENTIAL, RANDOM };
 
   PageFile();
   PageFile(const std::string& filename, char mode);
@@ -58,6 +137,48 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * pin a disk page in the buffer pool and access it without a copy.
+   * @param pid[IN] the page to pin
+   * @param handle[OUT] the handle to the pinned page
+   * @return error code. 0 if no error
+   */
+  RC fetch(PageId pid, PageHandle& handle) const;
+
+  /**
+   * pin a page that is going to be overwritten entirely. the page is
+   * not read from the disk; if it is not cached its content is zeroed.
+   * as with write(), if (pid >= endPid()), the file is expanded such that
+   * endPid() becomes (pid + 1). call markDirty() on the handle once the
+   * page has been filled.
+   * @param pid[IN] the page to pin
+   * @param handle[OUT] the handle to the pinned page
+   * @return error code. 0 if no error
+   */
+  RC fetchNew(PageId pid, PageHandle& handle);
+
+  /**
+   * tell the operating system how the pages of the file will be accessed,
+   * so that it can read ahead (SEQUENTIAL) or avoid doing so (RANDOM).
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(AccessPattern pattern) const;
+
+  /**
+   * ask the operating system to start reading pages that are going to be
+   * fetched soon, so that the fetch does not wait for the disk.
+   * @param pid[IN] the first page to read ahead
+   * @param count[IN] the # of consecutive pages to read ahead
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count = 1) const;
+
+  /**
+   * @return the size of the pages of the file in bytes
+   */
+  int getPageSize() const { return pageSize; }
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -69,44 +190,46 @@ class PageFile {
   /**
    * @return the total # of disk reads
    */
-  static int getPageReadCount()  { return readCount; }
+  static int getPageReadCount()  { return readCount.load(); }
   
   /**
    * @return the total # of disk writes
    */
-  static int getPageWriteCount() { return writeCount; }
-
- protected:
-  /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
-   * @return error code. 0 if no error
-   */
-  RC seek(PageId pid) const;
+  static int getPageWriteCount() { return writeCount.load(); }
 
  private:
+  friend class BufferPool;
+  friend class PageHandle;
+
+  // pin pid in a pool frame, reading it from the disk unless fill is false
+  RC pin(PageId pid, bool fill, PageHandle& handle) const;
+
+  // read the header of an existing file or write the header of a new one
+  RC readHeader(off_t fileSize, bool create);
+
+  // write a pool frame back to the disk. used by BufferPool.
+  static RC writePage(int fd, off_t offset, const void* buffer, int size);
+
+  // the position of page pid in the file
+  off_t pageOffset(PageId pid) const { return base + (off_t)pid * pageSize; }
+
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
-
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
-
-  static int cacheClock; // clock tick counter for LRU policy
-
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
-
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  std::atomic<PageId> epid;   // (last page id + 1) of the file
+  int     pageSize;   // the size of a page of the file
+  off_t   base;       // the position of page 0 (the size of the header)
+  BufferPool* pool;   // the pool caching pages of this page size
+  int     poolFile;   // the number of the file in the pool
+
+  // the mapping of a file opened in 'r' mode. NULL if not mapped.
+  // touched records which mapped pages were accessed at least once,
+  // so that the first access to a page is counted as a page read.
+  char*   map;
+  std::unique_ptr<std::atomic<bool>[]> touched;
+
+  // pages are cached in the process-wide BufferPool.
+  // only the pages actually read from or written to the disk are counted.
+  static std::atomic<int> readCount;  // total # of page reads 
+  static std::atomic<int> writeCount; // total # of page writes 
 };
   
 #endif // PAGEFILE_H
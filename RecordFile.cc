@@ -10,9 +10,63 @@
 #include "Bruinbase.h"
 #include "RecordFile.h"
 #include <cstring>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <utility>
 
 using std::string;
 
+//
+// the layout of a page of a slotted file. a page starts with a negative
+// tag, which tells it from a page of the legacy format, whose first four
+// bytes are its # records. the slot directory follows the header and
+// grows toward the end of the page, while the records are stored from
+// the end of the page toward the directory.
+//
+//   tag | # slots | start of records | slot 0 | slot 1 | ... | records
+//
+// a slot is the offset and the size of its record as 16-bit numbers,
+// and a record is its key followed by its value. the value of a record
+// whose size has OVERFLOW_FLAG set is kept in overflow pages; the record
+// then holds the key, the length of the value and its first overflow page.
+//
+#define SLOTTED_TAG           (-1)
+#define SLOTTED_COUNT         (sizeof(int))
+#define SLOTTED_START         (2*sizeof(int))
+#define SLOTTED_HEADER_SIZE   (3*sizeof(int))
+#define SLOT_SIZE             (2*sizeof(uint16_t))
+#define OVERFLOW_FLAG         0x8000
+#define OVERFLOW_RECORD_SIZE  (2*sizeof(int) + sizeof(PageId))
+
+//
+// a row group of a columnar file is its key page followed by its value
+// pages. the key page holds the # of records, the smallest and the
+// largest key (the zone map of the page) and the # of value pages,
+// followed by the keys and then by the location of every value: the
+// value page (0 for the page right after the key page) and the slot.
+// value pages are laid out like slotted pages.
+//
+//   tag | # records | min key | max key | # value pages | keys | locations
+//
+#define COLUMN_TAG            (-3)
+#define COLUMN_COUNT          (sizeof(int))
+#define COLUMN_MIN_KEY        (2*sizeof(int))
+#define COLUMN_MAX_KEY        (3*sizeof(int))
+#define COLUMN_VALUE_PAGES    (4*sizeof(int))
+#define COLUMN_HEADER_SIZE    (5*sizeof(int))
+#define COLUMN_ENTRY_SIZE     (sizeof(int) + 2*sizeof(uint16_t))
+#define VALUE_TAG             (-4)
+
+//
+// an overflow page holds the next page of its chain (-1 for the last
+// one) and the # of value bytes in the page after the tag
+//
+#define OVERFLOW_TAG          (-2)
+#define OVERFLOW_NEXT         (sizeof(int))
+#define OVERFLOW_LENGTH       (sizeof(int) + sizeof(PageId))
+#define OVERFLOW_HEADER_SIZE  (2*sizeof(int) + sizeof(PageId))
+
 //
 // helper functions for page manipultation
 //
@@ -32,36 +86,31 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+// get the tag of a page. pages of the legacy format have no tag
+static int getPageTag(const char* page);
 
-//
-// helper functions for RecordId manipulation
-//
+// initialize an empty slotted page, or a value page of a columnar file
+static void initSlottedPage(char* page, int pageSize, int tag);
 
-// postfix record id iterator
-RecordId operator++ (RecordId& rid, int)
-{
-  RecordId prid(rid);
+// the # of records of a page of the format
+static int pageCapacity(RecordFile::Format format, int pageSize);
 
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  }
+// get the offset and the size of the record in the n'th slot of a slotted page
+static void readSlotEntry(const char* page, int n, int& offset, int& size);
 
-  return prid;
-}
+// the largest record stored in a slotted page. longer values go to overflow pages
+static int maxRecordSize(int pageSize);
 
-// prefix record id iterator
-RecordId& operator++ (RecordId& rid)
-{
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  } 
+// check whether a record of the size fits in the free space of a slotted page
+static bool recordFits(const char* page, int size);
+
+// add a record of the key and the body to a new slot of a slotted page
+static void addRecord(char* page, int key, const void* body, int bodySize, bool overflow);
 
-  return rid;
-}
+
+//
+// helper functions for RecordId manipulation
+//
 
 // RecordId comparators
 bool operator < (const RecordId& r1, const RecordId& r2)
@@ -107,39 +156,74 @@ RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  recordsPerPage = RECORDS_PER_PAGE;
+  format = LEGACY;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  erid.pid = 0;
+  erid.sid = 0;
+  recordsPerPage = RECORDS_PER_PAGE;
+  format = LEGACY;
   open(filename, mode);
 }
 
-RC RecordFile::open(const string& filename, char mode)
+RC RecordFile::open(const string& filename, char mode, Format format)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PageHandle page;
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
-  
-  //
-  // in the rest of this function, we set the end record id
-  //
 
   // get the end pid of the file
   erid.pid = pf.endPid();
 
-  // if the end pid is zero, the file is empty.
-  // set the end record id to (0, 0).
+  // if the end pid is zero, the file is empty. it is written in the
+  // requested format. set the end record id to (0, 0).
   if (erid.pid == 0) {
+    this->format = format;
+    recordsPerPage = pageCapacity(format, pf.getPageSize());
     erid.sid = 0;
     return 0;
   }
 
+  // the first page tells the format of the file. it is always a page of
+  // records (or keys), since one is added before the pages it refers to.
+  if ((rc = pf.fetch(0, page)) < 0) {
+    erid.pid = erid.sid = 0;
+    pf.close();
+    return rc;
+  }
+  int tag = getPageTag(page.data());
+  this->format = (tag == SLOTTED_TAG) ? SLOTTED : (tag == COLUMN_TAG) ? COLUMNAR : LEGACY;
+  recordsPerPage = pageCapacity(this->format, pf.getPageSize());
+
+  if (this->format != LEGACY) {
+    // the end record id follows the last record of the last record page.
+    // overflow pages (or value pages) may come after it.
+    for (erid.pid--; erid.pid > 0; erid.pid--) {
+      if ((rc = pf.fetch(erid.pid, page)) < 0) {
+        erid.pid = erid.sid = 0;
+        pf.close();
+        return rc;
+      }
+      if (getPageTag(page.data()) == tag) break;
+    }
+    if (erid.pid == 0 && (rc = pf.fetch(0, page)) < 0) {
+      pf.close();
+      return rc;
+    }
+    // both kinds of pages keep their # of records right after the tag
+    memcpy(&erid.sid, page.data() + SLOTTED_COUNT, sizeof(int));
+    return 0;
+  }
+
   // obtain # records in the last page to set sid of the end record id.
   // read the last page of the file and get # records in the page.
   // remeber that the id of the last page is endPid()-1 not endPid().
-  if ((rc = pf.read(--erid.pid, page)) < 0) {
+  if ((rc = pf.fetch(--erid.pid, page)) < 0) {
     // an error occurred during page read
     erid.pid = erid.sid = 0;
     pf.close();
@@ -147,8 +231,8 @@ RC RecordFile::open(const string& filename, char mode)
   }
 
   // get # records in the last page
-  erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  erid.sid = getRecordCount(page.data());
+  if (erid.sid >= recordsPerPage) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
@@ -159,27 +243,223 @@ RC RecordFile::open(const string& filename, char mode)
 
 RC RecordFile::close()
 {
+  RC rc;
+
+  // write the last row group of a columnar file
+  rc = writeGroup();
+
   erid.pid = 0;
   erid.sid = 0;
+  format = LEGACY;
 
-  return pf.close();
+  RC crc = pf.close();
+  return (rc < 0) ? rc : crc;
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PageHandle page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= recordsPerPage) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
+
+  // a record of the row group not written yet
+  if (!groupKeys.empty() && rid.pid == erid.pid) {
+    key = groupKeys[rid.sid];
+    value = groupValues[rid.sid];
+    return 0;
+  }
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  if (format == COLUMNAR) {
+    RecordBatch batch;
+    std::vector<int> rows(1, rid.sid);
+
+    // read the value through the key page like a scan would
+    if ((rc = readPage(rid.pid, batch, false)) < 0) return rc;
+    if (rid.sid >= batch.count) return RC_INVALID_RID;
+    if ((rc = readValues(batch, rows)) < 0) return rc;
+    key = batch.keys[rid.sid];
+    value.assign(batch.values[rid.sid]);
+    return 0;
+  }
+
+  // pin the page containing the record
+  if ((rc = pf.fetch(rid.pid, page)) < 0) return rc;
+
+  if (format == SLOTTED) {
+    int offset, size, count;
+    const char* data = page.data();
+
+    // the rid may point to an overflow page or past the last slot
+    memcpy(&count, data + SLOTTED_COUNT, sizeof(int));
+    if (getPageTag(data) != SLOTTED_TAG || rid.sid >= count) return RC_INVALID_RID;
+
+    readSlotEntry(data, rid.sid, offset, size);
+    memcpy(&key, data + offset, sizeof(int));
+    if (size & OVERFLOW_FLAG) {
+      int length;
+      PageId first;
+      memcpy(&length, data + offset + sizeof(int), sizeof(int));
+      memcpy(&first, data + offset + 2*sizeof(int), sizeof(PageId));
+      value.clear();
+      return readOverflow(first, length, value);
+    }
+    value.assign(data + offset + sizeof(int), size - sizeof(int));
+    return 0;
+  }
 
   // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  readSlot(page.data(), rid.sid, key, value);
+
+  return 0;
+}
+
+RC RecordFile::readPage(PageId pid, RecordBatch& batch, bool values) const
+{
+  RC rc;
+
+  batch.pid = pid;
+  batch.count = 0;
+  batch.minKey = INT_MIN;
+  batch.maxKey = INT_MAX;
+  batch.valuePages.clear();
+
+  // pin the page
+  if (pid < 0 || pid > erid.pid) return RC_INVALID_PID;
+  if ((rc = pf.fetch(pid, batch.page)) < 0) return rc;
+
+  const char* page = batch.page.data();
+  if (format == COLUMNAR) {
+    int count;
+
+    // only key pages hold records
+    batch.overflow.clear();
+    if (getPageTag(page) != COLUMN_TAG) return 0;
+    memcpy(&count, page + COLUMN_COUNT, sizeof(int));
+    if (count > recordsPerPage) count = recordsPerPage;
+    memcpy(&batch.minKey, page + COLUMN_MIN_KEY, sizeof(int));
+    memcpy(&batch.maxKey, page + COLUMN_MAX_KEY, sizeof(int));
+
+    // the keys are stored as an array
+    batch.keys.resize(count);
+    memcpy(batch.keys.data(), page + COLUMN_HEADER_SIZE, count * sizeof(int));
+    batch.values.assign(count, std::string_view());
+    batch.count = count;
+
+    if (values) {
+      std::vector<int> rows(count);
+      for (int n = 0; n < count; n++) rows[n] = n;
+      return readValues(batch, rows);
+    }
+    return 0;
+  }
+
+  if (format == SLOTTED) {
+    int count, offset, size;
+    std::vector<std::pair<int, size_t> > spilled;  // (slot, offset in overflow)
+
+    // overflow pages and pages torn by a failed append hold no records
+    batch.overflow.clear();
+    if (getPageTag(page) != SLOTTED_TAG) return 0;
+    memcpy(&count, page + SLOTTED_COUNT, sizeof(int));
+    if (count > recordsPerPage) count = recordsPerPage;
+
+    batch.keys.resize(count);
+    batch.values.resize(count);
+    for (int n = 0; n < count; n++) {
+      readSlotEntry(page, n, offset, size);
+      memcpy(&batch.keys[n], page + offset, sizeof(int));
+      if (size & OVERFLOW_FLAG) {
+        int length;
+        PageId first;
+        memcpy(&length, page + offset + sizeof(int), sizeof(int));
+        memcpy(&first, page + offset + 2*sizeof(int), sizeof(PageId));
+        spilled.push_back(std::make_pair(n, batch.overflow.size()));
+        if ((rc = readOverflow(first, length, batch.overflow)) < 0) return rc;
+      } else {
+        batch.values[n] = std::string_view(page + offset + sizeof(int), size - sizeof(int));
+      }
+    }
+
+    // the overflow buffer no longer moves; point the values into it
+    for (unsigned i = 0; i < spilled.size(); i++) {
+      size_t end = (i + 1 < spilled.size()) ? spilled[i + 1].second : batch.overflow.size();
+      batch.values[spilled[i].first] = std::string_view(batch.overflow.data() + spilled[i].second,
+                                                        end - spilled[i].second);
+    }
+    batch.count = count;
+    return 0;
+  }
+
+  // decode every slot of the page
+  int count = getRecordCount(page);
+  if (count > recordsPerPage) count = recordsPerPage;
+
+  batch.keys.resize(count);
+  batch.values.resize(count);
+  for (int n = 0; n < count; n++) {
+    const char* ptr = slotPtr(const_cast<char*>(page), n);
+    memcpy(&batch.keys[n], ptr, sizeof(int));
+    ptr += sizeof(int);
+    batch.values[n] = std::string_view(ptr, strnlen(ptr, MAX_VALUE_LENGTH));
+  }
+  batch.count = count;
+
+  return 0;
+}
+
+RC RecordFile::readValues(RecordBatch& batch, const std::vector<int>& rows) const
+{
+  RC  rc;
+  int valuePageCount, offset, size, count;
+  std::vector<std::pair<int, size_t> > spilled;  // (record, offset in overflow)
+
+  // the values of the other formats are read with their page
+  if (format != COLUMNAR || batch.count == 0) return 0;
+
+  const char* page = batch.page.data();
+  const char* locations = page + COLUMN_HEADER_SIZE + batch.count * sizeof(int);
+  memcpy(&valuePageCount, page + COLUMN_VALUE_PAGES, sizeof(int));
+  batch.valuePages.resize(valuePageCount);
+  batch.overflow.clear();
+
+  for (unsigned i = 0; i < rows.size(); i++) {
+    int n = rows[i];
+    uint16_t location[2];
+
+    // pin the value page holding the value, unless it is already pinned
+    memcpy(location, locations + n * sizeof(location), sizeof(location));
+    if (location[0] >= valuePageCount) return RC_INVALID_FILE_FORMAT;
+    PageHandle& valuePage = batch.valuePages[location[0]];
+    if (valuePage.data() == NULL &&
+        (rc = pf.fetch(batch.pid + 1 + location[0], valuePage)) < 0) return rc;
+
+    const char* data = valuePage.data();
+    memcpy(&count, data + SLOTTED_COUNT, sizeof(int));
+    if (getPageTag(data) != VALUE_TAG || location[1] >= count) return RC_INVALID_FILE_FORMAT;
+
+    readSlotEntry(data, location[1], offset, size);
+    if (size & OVERFLOW_FLAG) {
+      int length;
+      PageId first;
+      memcpy(&length, data + offset + sizeof(int), sizeof(int));
+      memcpy(&first, data + offset + 2*sizeof(int), sizeof(PageId));
+      spilled.push_back(std::make_pair(n, batch.overflow.size()));
+      if ((rc = readOverflow(first, length, batch.overflow)) < 0) return rc;
+    } else {
+      batch.values[n] = std::string_view(data + offset + sizeof(int), size - sizeof(int));
+    }
+  }
+
+  // the overflow buffer no longer moves; point the values into it
+  for (unsigned i = 0; i < spilled.size(); i++) {
+    size_t end = (i + 1 < spilled.size()) ? spilled[i + 1].second : batch.overflow.size();
+    batch.values[spilled[i].first] = std::string_view(batch.overflow.data() + spilled[i].second,
+                                                      end - spilled[i].second);
+  }
 
   return 0;
 }
@@ -187,33 +467,243 @@ RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  PageHandle page;
+
+  if (format == SLOTTED) return appendSlotted(key, value, rid);
+
+  if (format == COLUMNAR) {
+    // a new row group starts at the end of the file
+    if (groupKeys.empty()) {
+      erid.pid = pf.endPid();
+      erid.sid = 0;
+    }
+    groupKeys.push_back(key);
+    groupValues.push_back(value);
+    rid = erid;
+    erid.sid++;
+
+    // write the group when its key page is full
+    if (erid.sid >= recordsPerPage) return writeGroup();
+    return 0;
+  }
 
   // unless we are writing to the the first slot of an empty page,
   // we have to read the page first
   if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+    if ((rc = pf.fetch(erid.pid, page)) < 0) return rc;
   } else {
     // if this is the first slot of an empty page
     // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    if ((rc = pf.fetchNew(erid.pid, page)) < 0) return rc;
+    memset(page.data(), 0, pf.getPageSize());
   }
     
   // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
+  writeSlot(page.data(), erid.sid, key, value);
 
   // the first four bytes in the page stores # records in the page.
   // update this number.
-  setRecordCount(page, erid.sid + 1);
+  setRecordCount(page.data(), erid.sid + 1);
 
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  // the modified page is written to the disk by the buffer pool
+  page.markDirty();
     
   // we need to output the rid of the record slot
   rid = erid;
 
   // advance the end record id by one to the next empty slot
-  ++erid;
+  if (++erid.sid >= recordsPerPage) {
+    erid.pid++;
+    erid.sid = 0;
+  }
+
+  return 0;
+}
+
+RC RecordFile::appendSlotted(int key, const std::string& value, RecordId& rid)
+{
+  RC   rc;
+  PageHandle page;
+  int  pageSize = pf.getPageSize();
+
+  // a long value is kept in overflow pages and the record refers to them
+  bool overflow = (int)(sizeof(int) + value.size()) > maxRecordSize(pageSize);
+  int size = overflow ? OVERFLOW_RECORD_SIZE : sizeof(int) + value.size();
+
+  // add the record to the last record page if it fits there.
+  // otherwise start a new record page at the end of the file.
+  if (erid.sid > 0) {
+    if ((rc = pf.fetch(erid.pid, page)) < 0) return rc;
+    if (!recordFits(page.data(), size)) {
+      page.unpin();
+      erid.sid = 0;
+    }
+  }
+  if (erid.sid == 0) {
+    erid.pid = pf.endPid();
+    if ((rc = pf.fetchNew(erid.pid, page)) < 0) return rc;
+    initSlottedPage(page.data(), pageSize, SLOTTED_TAG);
+    page.markDirty();
+  }
+
+  if (overflow) {
+    // the overflow pages come after the record page
+    char body[OVERFLOW_RECORD_SIZE - sizeof(int)];
+    int length = value.size();
+    PageId first;
+    if ((rc = writeOverflow(value, first)) < 0) return rc;
+    memcpy(body, &length, sizeof(int));
+    memcpy(body + sizeof(int), &first, sizeof(PageId));
+    addRecord(page.data(), key, body, sizeof(body), true);
+  } else {
+    addRecord(page.data(), key, value.data(), value.size(), false);
+  }
+
+  // the modified page is written to the disk by the buffer pool
+  page.markDirty();
+
+  rid = erid;
+  erid.sid++;
+
+  return 0;
+}
+
+RC RecordFile::writeGroup()
+{
+  RC   rc;
+  PageHandle page;
+  int  pageSize = pf.getPageSize();
+  int  count = groupKeys.size();
+  int  minKey = INT_MAX, maxKey = INT_MIN;
+  PageId pid = erid.pid;  // the key page
+
+  if (count == 0) return 0;
+
+  // lay out the values in value pages, which follow the key page
+  std::vector<std::vector<char> > valuePages;
+  std::vector<uint16_t> locations(2 * count);
+  std::vector<std::pair<int, size_t> > spilled;  // (record, position of its first overflow page)
+  for (int n = 0; n < count; n++) {
+    const string& value = groupValues[n];
+    bool overflow = (int)(sizeof(int) + value.size()) > maxRecordSize(pageSize);
+    int size = overflow ? OVERFLOW_RECORD_SIZE : sizeof(int) + value.size();
+
+    if (valuePages.empty() || !recordFits(valuePages.back().data(), size)) {
+      valuePages.push_back(std::vector<char>(pageSize));
+      initSlottedPage(valuePages.back().data(), pageSize, VALUE_TAG);
+    }
+    char* data = valuePages.back().data();
+    int slot, offset;
+    memcpy(&slot, data + SLOTTED_COUNT, sizeof(int));
+    if (overflow) {
+      // the first overflow page is known once all value pages are laid out
+      char body[OVERFLOW_RECORD_SIZE - sizeof(int)];
+      int length = value.size();
+      PageId first = -1;
+      memcpy(body, &length, sizeof(int));
+      memcpy(body + sizeof(int), &first, sizeof(PageId));
+      addRecord(data, groupKeys[n], body, sizeof(body), true);
+      readSlotEntry(data, slot, offset, size);
+      spilled.push_back(std::make_pair(n, (valuePages.size() - 1) * pageSize + offset + 2*sizeof(int)));
+    } else {
+      addRecord(data, groupKeys[n], value.data(), value.size(), false);
+    }
+    locations[2*n] = valuePages.size() - 1;
+    locations[2*n + 1] = slot;
+    minKey = std::min(minKey, groupKeys[n]);
+    maxKey = std::max(maxKey, groupKeys[n]);
+  }
+
+  // the overflow pages come after the value pages
+  int valuePageCount = valuePages.size();
+  int capacity = pageSize - OVERFLOW_HEADER_SIZE;
+  PageId next = pid + 1 + valuePageCount;
+  for (unsigned i = 0; i < spilled.size(); i++) {
+    char* ptr = valuePages[spilled[i].second / pageSize].data() + spilled[i].second % pageSize;
+    memcpy(ptr, &next, sizeof(PageId));
+    next += (groupValues[spilled[i].first].size() + capacity - 1) / capacity;
+  }
+
+  // write the key page
+  if ((rc = pf.fetchNew(pid, page)) < 0) return rc;
+  char* data = page.data();
+  int tag = COLUMN_TAG;
+  memset(data, 0, pageSize);
+  memcpy(data, &tag, sizeof(int));
+  memcpy(data + COLUMN_COUNT, &count, sizeof(int));
+  memcpy(data + COLUMN_MIN_KEY, &minKey, sizeof(int));
+  memcpy(data + COLUMN_MAX_KEY, &maxKey, sizeof(int));
+  memcpy(data + COLUMN_VALUE_PAGES, &valuePageCount, sizeof(int));
+  memcpy(data + COLUMN_HEADER_SIZE, groupKeys.data(), count * sizeof(int));
+  memcpy(data + COLUMN_HEADER_SIZE + count * sizeof(int), locations.data(),
+         locations.size() * sizeof(uint16_t));
+  page.markDirty();
+  page.unpin();
+
+  // then the value pages and the overflow pages
+  for (int i = 0; i < valuePageCount; i++) {
+    if ((rc = pf.write(pid + 1 + i, valuePages[i].data())) < 0) return rc;
+  }
+  for (unsigned i = 0; i < spilled.size(); i++) {
+    PageId first;
+    if ((rc = writeOverflow(groupValues[spilled[i].first], first)) < 0) return rc;
+  }
+
+  groupKeys.clear();
+  groupValues.clear();
+
+  return 0;
+}
+
+RC RecordFile::writeOverflow(const std::string& value, PageId& first)
+{
+  RC  rc;
+  int pageSize = pf.getPageSize();
+  int capacity = pageSize - OVERFLOW_HEADER_SIZE;
+  int tag = OVERFLOW_TAG;
+
+  // the pages of a chain are appended one after another
+  first = pf.endPid();
+  for (size_t done = 0; done < value.size(); ) {
+    PageHandle page;
+    PageId pid = pf.endPid();
+    int length = std::min((size_t) capacity, value.size() - done);
+    PageId next = (done + length < value.size()) ? pid + 1 : -1;
+
+    if ((rc = pf.fetchNew(pid, page)) < 0) return rc;
+    char* data = page.data();
+    memset(data, 0, pageSize);
+    memcpy(data, &tag, sizeof(int));
+    memcpy(data + OVERFLOW_NEXT, &next, sizeof(PageId));
+    memcpy(data + OVERFLOW_LENGTH, &length, sizeof(int));
+    memcpy(data + OVERFLOW_HEADER_SIZE, value.data() + done, length);
+    page.markDirty();
+    done += length;
+  }
+
+  return 0;
+}
+
+RC RecordFile::readOverflow(PageId pid, int length, std::string& value) const
+{
+  RC  rc;
+  int capacity = pf.getPageSize() - OVERFLOW_HEADER_SIZE;
+
+  // append the value bytes of every page of the chain
+  while (length > 0) {
+    PageHandle page;
+    int n;
+
+    if ((rc = pf.fetch(pid, page)) < 0) return rc;
+    const char* data = page.data();
+    memcpy(&n, data + OVERFLOW_LENGTH, sizeof(int));
+    if (getPageTag(data) != OVERFLOW_TAG || n <= 0 || n > capacity || n > length) {
+      return RC_INVALID_FILE_FORMAT;
+    }
+    value.append(data + OVERFLOW_HEADER_SIZE, n);
+    memcpy(&pid, data + OVERFLOW_NEXT, sizeof(PageId));
+    length -= n;
+  }
 
   return 0;
 }
@@ -223,6 +713,11 @@ const RecordId& RecordFile::endRid() const
   return erid;
 }
 
+RC RecordFile::advise(PageFile::AccessPattern pattern) const
+{
+  return pf.advise(pattern);
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -238,6 +733,87 @@ static void setRecordCount(char* page, int count)
   memcpy(page, &count, sizeof(int));
 }
 
+static int getPageTag(const char* page)
+{
+  int tag;
+
+  // the tag of a page of a slotted or columnar file is negative, where the page
+  // of a legacy file has its # records
+  memcpy(&tag, page, sizeof(int));
+  return tag;
+}
+
+static void initSlottedPage(char* page, int pageSize, int tag)
+{
+  int count = 0;
+
+  // an empty page has no slots and its records start at the end of the page
+  memset(page, 0, pageSize);
+  memcpy(page, &tag, sizeof(int));
+  memcpy(page + SLOTTED_COUNT, &count, sizeof(int));
+  memcpy(page + SLOTTED_START, &pageSize, sizeof(int));
+}
+
+static int pageCapacity(RecordFile::Format format, int pageSize)
+{
+  switch (format) {
+  case RecordFile::SLOTTED:
+    return (pageSize - SLOTTED_HEADER_SIZE) / (SLOT_SIZE + sizeof(int));
+  case RecordFile::COLUMNAR:
+    return (pageSize - COLUMN_HEADER_SIZE) / COLUMN_ENTRY_SIZE;
+  default:
+    return (pageSize - sizeof(int)) / (sizeof(int) + RecordFile::MAX_VALUE_LENGTH);
+  }
+}
+
+static void readSlotEntry(const char* page, int n, int& offset, int& size)
+{
+  uint16_t slot[2];
+
+  memcpy(slot, page + SLOTTED_HEADER_SIZE + SLOT_SIZE*n, sizeof(slot));
+  offset = slot[0];
+  size = slot[1];
+}
+
+static int maxRecordSize(int pageSize)
+{
+  // keep at least four long records in a page so that the scans of
+  // short records do not pay for long ones
+  return (pageSize - SLOTTED_HEADER_SIZE) / 4 - SLOT_SIZE;
+}
+
+static bool recordFits(const char* page, int size)
+{
+  int count, start;
+
+  memcpy(&count, page + SLOTTED_COUNT, sizeof(int));
+  memcpy(&start, page + SLOTTED_START, sizeof(int));
+  return (int)(SLOTTED_HEADER_SIZE + SLOT_SIZE*(count + 1)) + size <= start;
+}
+
+static void addRecord(char* page, int key, const void* body, int bodySize, bool overflow)
+{
+  int count, start;
+  uint16_t slot[2];
+
+  memcpy(&count, page + SLOTTED_COUNT, sizeof(int));
+  memcpy(&start, page + SLOTTED_START, sizeof(int));
+
+  // store the record right before the records already in the page
+  start -= sizeof(int) + bodySize;
+  memcpy(page + start, &key, sizeof(int));
+  memcpy(page + start + sizeof(int), body, bodySize);
+
+  // and point the new slot to it
+  slot[0] = start;
+  slot[1] = (sizeof(int) + bodySize) | (overflow ? OVERFLOW_FLAG : 0);
+  memcpy(page + SLOTTED_HEADER_SIZE + SLOT_SIZE*count, slot, sizeof(slot));
+
+  count++;
+  memcpy(page + SLOTTED_COUNT, &count, sizeof(int));
+  memcpy(page + SLOTTED_START, &start, sizeof(int));
+}
+
 static char* slotPtr(char* page, int n) 
 {
   // compute the location of the n'th slot in a page.
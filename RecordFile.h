@@ -11,6 +11,8 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include "PageFile.h"
 
 /**
@@ -26,10 +28,6 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
-RecordId& operator++ (RecordId& rid);
-RecordId  operator++ (RecordId& rid, int);
-
 // RecordId comparators
 bool operator> (const RecordId& r1, const RecordId& r2);
 bool operator< (const RecordId& r1, const RecordId& r2);
@@ -39,15 +37,53 @@ bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
 /**
- * read/write a record to a file
+ * All records of one page of a RecordFile, decoded in one pass by
+ * RecordFile::readPage(). The keys and values are kept in separate
+ * arrays, and the values point directly into the page, which stays
+ * pinned in the buffer pool until the batch is filled again or destroyed.
+ * Values kept in overflow pages are copied into the batch instead.
+ * The values of a page of a columnar file live in separate value pages,
+ * which are pinned along with the page when the values are read.
+ * A batch can be reused for many pages without reallocating the arrays.
+ */
+struct RecordBatch {
+  PageId pid;                           // the page the records come from
+  int    count;                         // # of records in the batch
+  std::vector<int> keys;                // keys[i] is the key of slot i
+  std::vector<std::string_view> values; // values[i] is the value of slot i
+  int    minKey;                        // no key of the page is smaller
+  int    maxKey;                        //   or larger than these
+  PageHandle page;                      // the pinned page
+  std::vector<PageHandle> valuePages;   // the pinned value pages
+  std::string overflow;                 // the values read from overflow pages
+};
+
+/**
+ * read/write a record to a file.
+ * new files are written in the slotted format: a page keeps a directory
+ * of its records, and every record takes only as many bytes as its value.
+ * a value too long to share a page with others is stored in a chain of
+ * overflow pages, which are appended to the file next to the record pages.
+ * files of the legacy format, where every record takes a fixed slot of
+ * MAX_VALUE_LENGTH bytes, are still read and appended to in that format.
+ *
+ * a new file can be written in the columnar format instead. the records
+ * are then stored in row groups: a key page holds the keys of the group
+ * along with their smallest and largest key, and the values follow in
+ * value pages. a scan that filters on the key reads the key pages alone
+ * and skips those whose key range cannot match. the records of a group
+ * are kept in memory until the group is full or the file is closed.
  */
 class RecordFile {
  public:
 
-  // maximum length of the value field
+  // the formats of a file. see above
+  enum Format { LEGACY, SLOTTED, COLUMNAR };
+
+  // maximum length of the value field of the legacy format
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
+  // number of record slots per page of a legacy 1KB file
   static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
@@ -60,9 +96,11 @@ class RecordFile {
    * when opened in 'w' mode, if the file does not exist, it is created.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param format[IN] the format of the file if it is created.
+   *                   an existing file keeps its format
    * @return error code. 0 if no error
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, Format format = SLOTTED);
 
   /**
    * close the file.
@@ -79,6 +117,26 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read all records stored in a page. this is much cheaper than calling
+   * read() for every slot of the page when the file is scanned.
+   * @param pid[IN] the page to read
+   * @param batch[OUT] the records of the page
+   * @param values[IN] false to leave the values of a columnar file
+   *                   unread. they can be read later by readValues()
+   * @return error code. 0 if no error
+   */
+  RC readPage(PageId pid, RecordBatch& batch, bool values = true) const;
+
+  /**
+   * read the values of some records of a batch read by readPage() without
+   * its values. the value pages holding no such record are not read.
+   * @param batch[IN/OUT] the batch
+   * @param rows[IN] the indexes of the records in the batch
+   * @return error code. 0 if no error
+   */
+  RC readValues(RecordBatch& batch, const std::vector<int>& rows) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -92,13 +150,46 @@ class RecordFile {
 
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
+   * in a slotted or columnar file, the pid is the last page holding
+   * records, and the pages before it that are not record pages (or key
+   * pages) hold no records.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * tell the underlying PageFile how the records will be accessed.
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(PageFile::AccessPattern pattern) const;
+
+  /**
+   * @return the number of record slots per page, which depends on
+   *         the page size of the file. for a slotted or columnar
+   *         file, the most records a page can hold
+   */
+  int getRecordsPerPage() const { return recordsPerPage; }
+
+  /**
+   * @return the format of the file
+   */
+  Format getFormat() const { return format; }
+
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  int recordsPerPage;  // # of record slots per page of the file
+  Format format;   // the format of the file
+
+  // the records of the row group of a columnar file not written yet
+  std::vector<int> groupKeys;
+  std::vector<std::string> groupValues;
+
+  RC appendSlotted(int key, const std::string& value, RecordId& rid);
+  RC writeGroup();
+  RC writeOverflow(const std::string& value, PageId& first);
+  RC readOverflow(PageId pid, int length, std::string& value) const;
 };
 
 #endif // RECORDFILE_H
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "ResultSink.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+using std::string_view;
+
+ResultSink::ResultSink(int fd, Format format)
+{
+  this->fd = fd;
+  this->format = format;
+  buffer = new char[BUFFER_SIZE];
+  used = 0;
+  error = 0;
+
+  // the rows follow whatever was printed through stdio so far
+  fflush(stdout);
+}
+
+ResultSink::~ResultSink()
+{
+  flush();
+  delete [] buffer;
+}
+
+ResultSink::Format ResultSink::defaultFormat()
+{
+  const char* s = getenv("BRUINBASE_OUTPUT");
+  if (s != NULL && strcmp(s, "csv") == 0) return CSV;
+  if (s != NULL && strcmp(s, "binary") == 0) return BINARY;
+  return TEXT;
+}
+
+void ResultSink::writeTuple(int attr, int key, string_view value)
+{
+  // count(*) writes no row per tuple
+  if (attr < 1 || attr > 3) return;
+
+  if (format == BINARY) {
+    // the length of the row, then the key and/or the value
+    int size = ((attr & 1) ? sizeof(int) : 0) + ((attr & 2) ? value.size() : 0);
+    append((const char*) &size, sizeof(int));
+    if (attr & 1) append((const char*) &key, sizeof(int));
+    if (attr & 2) append(value.data(), value.size());
+    return;
+  }
+
+  switch (attr) {
+  case 1:  // SELECT key
+    appendInt(key);
+    break;
+  case 2:  // SELECT value
+    if (format == CSV) appendQuoted(value, '"', true);
+    else append(value.data(), value.size());
+    break;
+  case 3:  // SELECT *
+    appendInt(key);
+    if (format == CSV) {
+      append(',');
+      appendQuoted(value, '"', true);
+    } else {
+      append(' ');
+      appendQuoted(value, '\'', false);
+    }
+    break;
+  }
+  append('\n');
+}
+
+void ResultSink::writeCount(int count)
+{
+  if (format == BINARY) {
+    int size = sizeof(int);
+    append((const char*) &size, sizeof(int));
+    append((const char*) &count, sizeof(int));
+    return;
+  }
+  appendInt(count);
+  append('\n');
+}
+
+RC ResultSink::flush()
+{
+  if (used > 0) {
+    writeBytes(buffer, used);
+    used = 0;
+  }
+  return error;
+}
+
+void ResultSink::append(const char* data, size_t size)
+{
+  if (used + size > (size_t) BUFFER_SIZE) {
+    flush();
+    // a value larger than the buffer goes out on its own
+    if (size > (size_t) BUFFER_SIZE) {
+      writeBytes(data, size);
+      return;
+    }
+  }
+  memcpy(buffer + used, data, size);
+  used += size;
+}
+
+void ResultSink::append(char c)
+{
+  if (used == BUFFER_SIZE) flush();
+  buffer[used++] = c;
+}
+
+void ResultSink::appendInt(int n)
+{
+  char digits[12];
+  char* p = digits + sizeof(digits);
+
+  // write the digits from the last one. the magnitude is taken as an
+  // unsigned number so that INT_MIN does not overflow.
+  unsigned u = (n < 0) ? 0u - (unsigned) n : (unsigned) n;
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u != 0);
+  if (n < 0) *--p = '-';
+
+  append(p, digits + sizeof(digits) - p);
+}
+
+void ResultSink::appendQuoted(string_view value, char quote, bool doubleQuotes)
+{
+  append(quote);
+  if (!doubleQuotes) {
+    append(value.data(), value.size());
+  } else {
+    // a quote inside the value is written twice
+    size_t from = 0, at;
+    while ((at = value.find(quote, from)) != string_view::npos) {
+      append(value.data() + from, at + 1 - from);
+      append(quote);
+      from = at + 1;
+    }
+    append(value.data() + from, value.size() - from);
+  }
+  append(quote);
+}
+
+void ResultSink::writeBytes(const char* data, size_t size)
+{
+  // after a failed write, the rest of the result is dropped
+  while (size > 0 && error == 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      error = RC_FILE_WRITE_FAILED;
+      break;
+    }
+    data += n;
+    size -= n;
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <string_view>
+#include "Bruinbase.h"
+
+/**
+ * Writes the result of a SELECT to a file descriptor. The rows are
+ * formatted into a buffer, without stdio, and the buffer is written with
+ * a single write() whenever it fills up and when the sink is flushed.
+ * The rows can be written as
+ *   TEXT:   the key, the value, or both as key 'value', one row per line
+ *   CSV:    the key and/or the value in double quotes, separated by a comma
+ *   BINARY: a 4-byte length of the row followed by the row, which is the
+ *           4-byte key and/or the bytes of the value, in host byte order
+ * defaultFormat() reads the format from the environment variable
+ * BRUINBASE_OUTPUT ("text", "csv" or "binary", default text).
+ */
+class ResultSink {
+ public:
+
+  enum Format { TEXT, CSV, BINARY };
+
+  static const int BUFFER_SIZE = 64 * 1024;  // the size of the buffer
+
+  /**
+   * @param fd[IN] the file descriptor to write to
+   * @param format[IN] the format of the rows
+   */
+  ResultSink(int fd, Format format);
+
+  /**
+   * flush the rows still in the buffer.
+   */
+  ~ResultSink();
+
+  /**
+   * add a row of a matching tuple.
+   * @param attr[IN] the attribute of the SELECT: 1 for the key, 2 for
+   *                 the value, 3 for both. nothing is written for others
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple
+   */
+  void writeTuple(int attr, int key, std::string_view value);
+
+  /**
+   * add the row of a count(*).
+   * @param count[IN] the # of matching tuples
+   */
+  void writeCount(int count);
+
+  /**
+   * write out the rows in the buffer.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * @return the format set by BRUINBASE_OUTPUT
+   */
+  static Format defaultFormat();
+
+ private:
+  int    fd;       // the file descriptor to write to
+  Format format;   // the format of the rows
+  char*  buffer;   // the formatted rows not written yet
+  int    used;     // the # of bytes in the buffer
+  RC     error;    // the first error of a write. 0 if none
+
+  // append bytes to the buffer, writing it out first if they do not fit
+  void append(const char* data, size_t size);
+  void append(char c);
+  void appendInt(int n);
+  void appendQuoted(std::string_view value, char quote, bool doubleQuotes);
+  void writeBytes(const char* data, size_t size);
+};
+
+#endif // RESULTSINK_H
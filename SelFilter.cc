@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "SelFilter.h"
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <functional>
+
+using std::string_view;
+using std::vector;
+
+typedef SelFilter::KeyConds KeyConds;
+typedef SelFilter::KeyKernel KeyKernel;
+
+/*
+ * The key kernels are instantiated for the shape of the key conditions:
+ * a range, excluded keys, or both. A key is in [lo, hi] exactly when
+ * key - lo, as an unsigned number, is not larger than hi - lo, so the
+ * range costs one compare however many conditions it was folded from.
+ */
+template <bool Range, bool Exclude>
+struct ScalarKernel {
+  // check the keys [from, count) and append the indexes of those that pass
+  static int select(const KeyConds& c, const int* keys, int from, int count, int* rows, int n)
+  {
+    unsigned width = (unsigned)c.hi - (unsigned)c.lo;
+    for (int i = from; i < count; i++) {
+      bool pass = true;
+      if (Range) pass = (unsigned)keys[i] - (unsigned)c.lo <= width;
+      if (Exclude) {
+        for (unsigned e = 0; e < c.excluded.size(); e++) pass &= (keys[i] != c.excluded[e]);
+      }
+      // write the index either way and keep it only if the key passed
+      rows[n] = i;
+      n += pass;
+    }
+    return n;
+  }
+
+  static int run(const KeyConds& c, const int* keys, int count, int* rows)
+  {
+    return select(c, keys, 0, count, rows, 0);
+  }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+ * The vector kernels check 4 or 8 keys at once. The processor compares
+ * only signed numbers, so the unsigned range check flips the sign bits of
+ * both sides first. The lanes that pass are turned into indexes from the
+ * bits of the mask.
+ */
+template <bool Range, bool Exclude>
+struct Sse2Kernel {
+  __attribute__((target("sse2")))
+  static int run(const KeyConds& c, const int* keys, int count, int* rows)
+  {
+    __m128i lo = _mm_set1_epi32(c.lo);
+    __m128i width = _mm_set1_epi32((int)(((unsigned)c.hi - (unsigned)c.lo) ^ 0x80000000u));
+    __m128i sign = _mm_set1_epi32(INT_MIN);
+    __m128i all = _mm_set1_epi32(-1);
+    int n = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+      __m128i k = _mm_loadu_si128((const __m128i*)(keys + i));
+      __m128i pass = all;
+      if (Range) {
+        __m128i d = _mm_xor_si128(_mm_sub_epi32(k, lo), sign);
+        pass = _mm_xor_si128(_mm_cmpgt_epi32(d, width), all);
+      }
+      if (Exclude) {
+        for (unsigned e = 0; e < c.excluded.size(); e++) {
+          pass = _mm_andnot_si128(_mm_cmpeq_epi32(k, _mm_set1_epi32(c.excluded[e])), pass);
+        }
+      }
+      unsigned bits = _mm_movemask_ps(_mm_castsi128_ps(pass));
+      while (bits != 0) {
+        rows[n++] = i + __builtin_ctz(bits);
+        bits &= bits - 1;
+      }
+    }
+    return ScalarKernel<Range, Exclude>::select(c, keys, i, count, rows, n);
+  }
+};
+
+template <bool Range, bool Exclude>
+struct Avx2Kernel {
+  __attribute__((target("avx2")))
+  static int run(const KeyConds& c, const int* keys, int count, int* rows)
+  {
+    __m256i lo = _mm256_set1_epi32(c.lo);
+    __m256i width = _mm256_set1_epi32((int)(((unsigned)c.hi - (unsigned)c.lo) ^ 0x80000000u));
+    __m256i sign = _mm256_set1_epi32(INT_MIN);
+    __m256i all = _mm256_set1_epi32(-1);
+    int n = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+      __m256i k = _mm256_loadu_si256((const __m256i*)(keys + i));
+      __m256i pass = all;
+      if (Range) {
+        __m256i d = _mm256_xor_si256(_mm256_sub_epi32(k, lo), sign);
+        pass = _mm256_xor_si256(_mm256_cmpgt_epi32(d, width), all);
+      }
+      if (Exclude) {
+        for (unsigned e = 0; e < c.excluded.size(); e++) {
+          pass = _mm256_andnot_si256(_mm256_cmpeq_epi32(k, _mm256_set1_epi32(c.excluded[e])), pass);
+        }
+      }
+      unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+      while (bits != 0) {
+        rows[n++] = i + __builtin_ctz(bits);
+        bits &= bits - 1;
+      }
+    }
+    return ScalarKernel<Range, Exclude>::select(c, keys, i, count, rows, n);
+  }
+};
+#endif
+
+// the kernel of a family for the shape of the key conditions
+template <template <bool, bool> class Kernel>
+static KeyKernel shapeKernel(bool range, bool exclude)
+{
+  if (!range) return Kernel<false, true>::run;
+  return exclude ? Kernel<true, true>::run : Kernel<true, false>::run;
+}
+
+// the widest kernel family the processor supports
+enum KernelFamily { SCALAR, SSE2, AVX2 };
+
+static KernelFamily chooseFamily()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return AVX2;
+  if (__builtin_cpu_supports("sse2")) return SSE2;
+#endif
+  return SCALAR;
+}
+
+static const KernelFamily kernelFamily = chooseFamily();
+
+static KeyKernel chooseKernel(bool range, bool exclude)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (kernelFamily == AVX2) return shapeKernel<Avx2Kernel>(range, exclude);
+  if (kernelFamily == SSE2) return shapeKernel<Sse2Kernel>(range, exclude);
+#endif
+  return shapeKernel<ScalarKernel>(range, exclude);
+}
+
+/*
+ * A value condition applies its comparator, one of the std:: comparison
+ * functors on int, to the result of compare(). (In)equality only needs
+ * to look at the bytes when the lengths match.
+ */
+template <class Cmp>
+struct ValueCompare {
+  static bool test(string_view value, string_view constant)
+  {
+    return Cmp()(value.compare(constant), 0);
+  }
+};
+
+template <>
+struct ValueCompare<std::equal_to<int> > {
+  static bool test(string_view value, string_view constant) { return value == constant; }
+};
+
+template <>
+struct ValueCompare<std::not_equal_to<int> > {
+  static bool test(string_view value, string_view constant) { return value != constant; }
+};
+
+// compact the selection vector in place to the rows whose values pass
+template <class Cmp>
+static size_t selectValueRows(const string_view* values, string_view constant,
+                              int* rows, size_t count)
+{
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    rows[n] = rows[i];
+    n += ValueCompare<Cmp>::test(values[rows[i]], constant);
+  }
+  return n;
+}
+
+SelFilter::SelFilter(const vector<SelCond>& cond)
+{
+  long long lo = INT_MIN, hi = INT_MAX;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1) {
+      // fold the conditions on the key into a range
+      long long v = atoi(cond[i].value);
+      switch (cond[i].comp) {
+      case SelCond::EQ: lo = std::max(lo, v); hi = std::min(hi, v); break;
+      case SelCond::NE: keyConds.excluded.push_back(v); break;
+      case SelCond::LT: hi = std::min(hi, v - 1); break;
+      case SelCond::GT: lo = std::max(lo, v + 1); break;
+      case SelCond::LE: hi = std::min(hi, v); break;
+      case SelCond::GE: lo = std::max(lo, v); break;
+      }
+    } else if (cond[i].attr == 2) {
+      ValueTerm t;
+      t.value = cond[i].value;
+      // the rank of a comparator by how few tuples it usually lets through
+      switch (cond[i].comp) {
+      case SelCond::EQ:
+        t.rank = 0;
+        t.select = selectValueRows<std::equal_to<int> >;
+        t.test = ValueCompare<std::equal_to<int> >::test;
+        break;
+      case SelCond::NE:
+        t.rank = 2;
+        t.select = selectValueRows<std::not_equal_to<int> >;
+        t.test = ValueCompare<std::not_equal_to<int> >::test;
+        break;
+      case SelCond::LT:
+        t.rank = 1;
+        t.select = selectValueRows<std::less<int> >;
+        t.test = ValueCompare<std::less<int> >::test;
+        break;
+      case SelCond::GT:
+        t.rank = 1;
+        t.select = selectValueRows<std::greater<int> >;
+        t.test = ValueCompare<std::greater<int> >::test;
+        break;
+      case SelCond::LE:
+        t.rank = 1;
+        t.select = selectValueRows<std::less_equal<int> >;
+        t.test = ValueCompare<std::less_equal<int> >::test;
+        break;
+      case SelCond::GE:
+        t.rank = 1;
+        t.select = selectValueRows<std::greater_equal<int> >;
+        t.test = ValueCompare<std::greater_equal<int> >::test;
+        break;
+      }
+      valueTerms.push_back(t);
+    }
+  }
+
+  // an empty range is kept as lo > hi.
+  // only the excluded keys inside the range matter.
+  if (lo > hi) {
+    lo = 1;
+    hi = 0;
+  }
+  keyConds.lo = (int) lo;
+  keyConds.hi = (int) hi;
+  vector<int>& excluded = keyConds.excluded;
+  excluded.erase(std::remove_if(excluded.begin(), excluded.end(),
+                                [&](int v) { return v < lo || v > hi; }), excluded.end());
+  std::sort(excluded.begin(), excluded.end());
+  excluded.erase(std::unique(excluded.begin(), excluded.end()), excluded.end());
+
+  bool range = (lo != INT_MIN || hi != INT_MAX);
+  keyKernel = (range || !excluded.empty()) ? chooseKernel(range, !excluded.empty()) : NULL;
+
+  // the order of the conditions does not change the result.
+  // put those that drop the most tuples first.
+  std::stable_sort(valueTerms.begin(), valueTerms.end(),
+                   [](const ValueTerm& a, const ValueTerm& b) { return a.rank < b.rank; });
+}
+
+void SelFilter::selectKeys(const int* keys, int count, vector<int>& rows) const
+{
+  if (keyConds.lo > keyConds.hi) {
+    rows.clear();
+    return;
+  }
+
+  rows.resize(count);
+  if (keyKernel == NULL) {
+    for (int i = 0; i < count; i++) rows[i] = i;
+    return;
+  }
+  rows.resize(keyKernel(keyConds, keys, count, rows.data()));
+}
+
+void SelFilter::selectValues(const string_view* values, vector<int>& rows) const
+{
+  for (unsigned t = 0; t < valueTerms.size() && !rows.empty(); t++) {
+    rows.resize(valueTerms[t].select(values, valueTerms[t].value, rows.data(), rows.size()));
+  }
+}
+
+bool SelFilter::match(int key, string_view value) const
+{
+  if (keyConds.lo > keyConds.hi) return false;
+  if ((unsigned)key - (unsigned)keyConds.lo > (unsigned)keyConds.hi - (unsigned)keyConds.lo) {
+    return false;
+  }
+  for (unsigned e = 0; e < keyConds.excluded.size(); e++) {
+    if (key == keyConds.excluded[e]) return false;
+  }
+  for (unsigned t = 0; t < valueTerms.size(); t++) {
+    if (!valueTerms[t].test(value, valueTerms[t].value)) return false;
+  }
+  return true;
+}
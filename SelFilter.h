@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef SELFILTER_H
+#define SELFILTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "SqlEngine.h"
+
+/**
+ * The conditions of a WHERE clause, prepared for checking batches of
+ * tuples. The conditions on the key are folded into one range [lo, hi]
+ * and a list of excluded keys (from <>), which are checked over a whole
+ * batch of keys with vector compares and produce a selection vector, the
+ * indexes of the tuples that pass. The conditions on the value then
+ * narrow the selection vector down, the most selective condition first,
+ * so that later conditions see fewer tuples.
+ * Every loop is instantiated from a template for one comparator or one
+ * shape of key conditions, and picked once when the filter is built, so
+ * no loop branches on the kind of a condition.
+ */
+class SelFilter {
+ public:
+
+  /**
+   * @param cond[IN] the conditions. all of them must hold
+   */
+  SelFilter(const std::vector<SelCond>& cond);
+
+  /**
+   * @return true if some condition is on the value
+   */
+  bool hasValueConds() const { return !valueTerms.empty(); }
+
+  /**
+   * select the keys that satisfy all conditions on the key.
+   * @param keys[IN] the keys of a batch of tuples
+   * @param count[IN] the # of keys
+   * @param rows[OUT] the indexes of the selected keys, in ascending order
+   */
+  void selectKeys(const int* keys, int count, std::vector<int>& rows) const;
+
+  /**
+   * drop the rows whose values do not satisfy the conditions on the value.
+   * @param values[IN] values[n] is the value of row n
+   * @param rows[IN/OUT] the selected rows
+   */
+  void selectValues(const std::string_view* values, std::vector<int>& rows) const;
+
+  /**
+   * check a single tuple against all conditions.
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple
+   * @return true if the tuple satisfies all conditions
+   */
+  bool match(int key, std::string_view value) const;
+
+  // the conditions on the key: the key must be in [lo, hi] and must not
+  // be any of the excluded keys. lo > hi if no key can satisfy them.
+  struct KeyConds {
+    int lo;
+    int hi;
+    std::vector<int> excluded;
+  };
+
+  // a loop selecting the keys of a batch that satisfy the conditions
+  typedef int (*KeyKernel)(const KeyConds& conds, const int* keys, int count, int* rows);
+
+  // a loop compacting a selection vector to the values satisfying a condition
+  typedef size_t (*ValueKernel)(const std::string_view* values, std::string_view constant,
+                                int* rows, size_t count);
+
+  // a check of a single value against a condition
+  typedef bool (*ValueTest)(std::string_view value, std::string_view constant);
+
+ private:
+  // a condition on the value with the loops for its comparator
+  struct ValueTerm {
+    std::string value;   // the constant to compare with
+    int rank;            // the terms with smaller ranks are checked first
+    ValueKernel select;
+    ValueTest test;
+  };
+
+  KeyConds keyConds;                  // the conditions on the key
+  KeyKernel keyKernel;                // the loop for their shape. NULL if
+                                      //   every key satisfies them
+  std::vector<ValueTerm> valueTerms;  // the conditions on the value,
+                                      //   the most selective one first
+};
+
+#endif // SELFILTER_H
@@ -12,8 +12,22 @@
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <climits>
+#include <unistd.h>
+#include <algorithm>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "BTreeIndex.h"
+#include "StringIndex.h"
+#include "KeySorter.h"
+#include "SelFilter.h"
+#include "ResultSink.h"
 
 using namespace std;
 
@@ -34,124 +48,701 @@ RC SqlEngine::run(FILE *commandline) {
     return 0;
 }
 
-RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &cond) {
-    RecordFile rf;   // RecordFile containing the table
-    RecordId rid;  // record cursor for table scanning
+// number of pages handed to a scan worker at a time
+static const int MORSEL_PAGES = 16;
+
+// the matching tuples found in one morsel (page range) of a table scan
+struct ScanMorsel {
+    bool done;      // true when a worker finished the morsel
+    RC rc;          // error code of the worker. 0 if no error
+    int count;      // # of matching tuples
+    vector<pair<int, string> > tuples;  // matching tuples unless count(*)
+};
+
+static bool keyRange(const vector<SelCond> &cond, int &lo, int &hi);
+
+// scan the pages [first, last) of the table and collect the matching tuples.
+// pages whose keys all fall outside of [lo, hi] are skipped, and the values
+// of a columnar table are read only for the tuples whose keys match.
+static void scanMorsel(const RecordFile &rf, PageId first, PageId last, int attr,
+                       const SelFilter &filter, int lo, int hi, ScanMorsel &morsel) {
+    RecordBatch batch;
+    vector<int> rows;
+    const RecordId &erid = rf.endRid();
+    bool columnar = (rf.getFormat() == RecordFile::COLUMNAR);
+    bool needValue = (attr == 2 || attr == 3 || filter.hasValueConds());
+
+    if (last > erid.pid + 1) last = erid.pid + 1;
+    for (PageId pid = first; pid < last; pid++) {
+        if (pid == erid.pid && erid.sid == 0) break;
+
+        // read all tuples of the page, or only the keys of a columnar page
+        if ((morsel.rc = rf.readPage(pid, batch, !columnar)) < 0) return;
+        if (batch.count == 0 || batch.maxKey < lo || batch.minKey > hi) continue;
+
+        // narrow the tuples down by the keys, then by the values
+        filter.selectKeys(batch.keys.data(), batch.count, rows);
+        if (needValue && (morsel.rc = rf.readValues(batch, rows)) < 0) return;
+        filter.selectValues(batch.values.data(), rows);
+
+        morsel.count += rows.size();
+        if (attr != 4) {
+            for (unsigned i = 0; i < rows.size(); i++) {
+                int n = rows[i];
+                morsel.tuples.push_back(make_pair(batch.keys[n], string(batch.values[n])));
+            }
+        }
+    }
+}
 
+// # of scan workers. BRUINBASE_SCAN_THREADS overrides the # of cores.
+static int scanThreadCount(int morselCount) {
+    int n = thread::hardware_concurrency();
+    const char *s = getenv("BRUINBASE_SCAN_THREADS");
+    if (s != NULL && atoi(s) > 0) n = atoi(s);
+
+    if (n > morselCount) n = morselCount;
+    return (n < 1) ? 1 : n;
+}
+
+// answer the query by scanning the whole table
+static RC scanSelect(int attr, const string &table, const vector<SelCond> &cond,
+                     const RecordFile &rf, ResultSink &out) {
     RC rc;
-    int key;
-    string value;
     int count;
-    int diff;
+    int lo, hi;
 
-    // open the table file
-    if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-        fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
-        return rc;
+    // the range of keys to look at. keyRange() is a full range without
+    // conditions on the key, and an empty one for contradicting conditions.
+    keyRange(cond, lo, hi);
+    SelFilter filter(cond);
+
+    // scan the table file in morsels of MORSEL_PAGES pages.
+    // the workers take the next unscanned morsel until none is left,
+    // while this thread prints the results of the morsels in order.
+    // the workers stay at most a window of morsels ahead of the printing,
+    // so that the results waiting to be printed do not pile up.
+    rf.advise(PageFile::SEQUENTIAL);
+
+    const RecordId &erid = rf.endRid();
+    PageId endPid = erid.pid + (erid.sid > 0 ? 1 : 0);
+    int morselCount = (endPid + MORSEL_PAGES - 1) / MORSEL_PAGES;
+
+    vector<ScanMorsel> morsels(morselCount);
+    for (int i = 0; i < morselCount; i++) {
+        morsels[i].done = false;
+        morsels[i].rc = 0;
+        morsels[i].count = 0;
     }
 
-    // scan the table file from the beginning
-    rid.pid = rid.sid = 0;
-    count = 0;
-    while (rid < rf.endRid()) {
-        // read the tuple
-        if ((rc = rf.read(rid, key, value)) < 0) {
-            fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-            goto exit_select;
-        }
-
-        // check the conditions on the tuple
-        for (unsigned i = 0; i < cond.size(); i++) {
-            // compute the difference between the tuple value and the condition value
-            switch (cond[i].attr) {
-                case 1:
-                    diff = key - atoi(cond[i].value);
-                    break;
-                case 2:
-                    diff = strcmp(value.c_str(), cond[i].value);
-                    break;
+    int nextMorsel = 0;     // the next morsel to scan
+    int printed = 0;        // the # of morsels printed
+    atomic<bool> failed(false);
+    mutex doneLock;         // protects the two counters and the done flags
+    condition_variable doneCond;
+
+    vector<thread> workers;
+    int nworkers = scanThreadCount(morselCount);
+    int window = 2 * nworkers;
+    for (int w = 0; w < nworkers; w++) {
+        workers.push_back(thread([&]() {
+            for (;;) {
+                int i;
+                {
+                    unique_lock<mutex> lock(doneLock);
+                    while (!failed && nextMorsel < morselCount && nextMorsel >= printed + window) {
+                        doneCond.wait(lock);
+                    }
+                    if (failed || nextMorsel >= morselCount) break;
+                    i = nextMorsel++;
+                }
+
+                scanMorsel(rf, i * MORSEL_PAGES, (i + 1) * MORSEL_PAGES, attr, filter, lo, hi, morsels[i]);
+                if (morsels[i].rc < 0) failed = true;
+
+                lock_guard<mutex> lock(doneLock);
+                morsels[i].done = true;
+                doneCond.notify_all();
             }
+        }));
+    }
+
+    // merge the results of the morsels in table order
+    count = 0;
+    rc = 0;
+    for (int i = 0; i < morselCount && rc == 0; i++) {
+        {
+            unique_lock<mutex> lock(doneLock);
+            // after a failure, morsels that no worker took never complete
+            while (!morsels[i].done && !(failed && nextMorsel <= i)) doneCond.wait(lock);
+        }
+        if (!morsels[i].done || (rc = morsels[i].rc) < 0) {
+            if (rc == 0) rc = RC_FILE_READ_FAILED;
+            break;
+        }
+
+        count += morsels[i].count;
+        for (unsigned j = 0; j < morsels[i].tuples.size(); j++) {
+            out.writeTuple(attr, morsels[i].tuples[j].first, morsels[i].tuples[j].second);
+        }
+        vector<pair<int, string> >().swap(morsels[i].tuples);
+
+        // let the workers move the window forward
+        lock_guard<mutex> lock(doneLock);
+        printed = i + 1;
+        doneCond.notify_all();
+    }
+
+    {
+        // stop the workers waiting for the window after an error
+        lock_guard<mutex> lock(doneLock);
+        if (rc < 0) failed = true;
+        doneCond.notify_all();
+    }
+    for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+
+    if (rc < 0) {
+        // report the first error of the workers
+        for (int i = 0; i < morselCount; i++) {
+            if (morsels[i].rc < 0) { rc = morsels[i].rc; break; }
+        }
+        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+        return rc;
+    }
+
+    // print matching tuple count if "select count(*)"
+    if (attr == 4) {
+        out.writeCount(count);
+    }
+    return 0;
+}
 
-            // skip the tuple if any condition is not met
-            switch (cond[i].comp) {
-                case SelCond::EQ:
-                    if (diff != 0) goto next_tuple;
-                    break;
-                case SelCond::NE:
-                    if (diff == 0) goto next_tuple;
-                    break;
-                case SelCond::GT:
-                    if (diff <= 0) goto next_tuple;
-                    break;
-                case SelCond::LT:
-                    if (diff >= 0) goto next_tuple;
-                    break;
-                case SelCond::GE:
-                    if (diff < 0) goto next_tuple;
-                    break;
-                case SelCond::LE:
-                    if (diff > 0) goto next_tuple;
-                    break;
+// compute the range [lo, hi] of keys allowed by the conditions on the key.
+// return false if no condition restricts the key to a range.
+static bool keyRange(const vector<SelCond> &cond, int &lo, int &hi) {
+    long long l = INT_MIN, h = INT_MAX;
+    bool found = false;
+
+    for (unsigned i = 0; i < cond.size(); i++) {
+        if (cond[i].attr != 1 || cond[i].comp == SelCond::NE) continue;
+
+        long long v = atoi(cond[i].value);
+        switch (cond[i].comp) {
+            case SelCond::EQ: l = max(l, v); h = min(h, v); break;
+            case SelCond::GT: l = max(l, v + 1); break;
+            case SelCond::GE: l = max(l, v); break;
+            case SelCond::LT: h = min(h, v - 1); break;
+            case SelCond::LE: h = min(h, v); break;
+            default: break;
+        }
+        found = true;
+    }
+
+    // an empty range is returned as lo > hi.
+    // without any range condition, the range covers all keys.
+    if (l > h) { l = 1; h = 0; }
+    lo = (int) l;
+    hi = (int) h;
+    return found;
+}
+
+// compute the range [lo, hi] of values allowed by the conditions on the
+// value. lo or hi is NULL if no condition bounds the value from that side,
+// and the range is empty if lo > hi.
+// return false if no condition restricts the value to a range.
+static bool valueRange(const vector<SelCond> &cond, const char *&lo, const char *&hi) {
+    bool found = false;
+
+    lo = hi = NULL;
+    for (unsigned i = 0; i < cond.size(); i++) {
+        if (cond[i].attr != 2 || cond[i].comp == SelCond::NE) continue;
+
+        const char *v = cond[i].value;
+        bool raise = false, lower = false;
+        switch (cond[i].comp) {
+            case SelCond::EQ: raise = lower = true; break;
+            case SelCond::GT:
+            case SelCond::GE: raise = true; break;
+            case SelCond::LT:
+            case SelCond::LE: lower = true; break;
+            default: break;
+        }
+        if (raise && (lo == NULL || strcmp(v, lo) > 0)) lo = v;
+        if (lower && (hi == NULL || strcmp(v, hi) < 0)) hi = v;
+        found = true;
+    }
+    return found;
+}
+
+// narrow the range [lo, hi] down to the keys present in the index, using
+// the smallest and the largest key recorded in its metadata. a range
+// outside of them becomes empty and is answered without a lookup.
+static void pruneKeyRange(const BTreeIndex &idx, int &lo, int &hi) {
+    int minKey, maxKey;
+    if (idx.getKeyBounds(minKey, maxKey)) {
+        lo = max(lo, minKey);
+        hi = min(hi, maxKey);
+    } else if (idx.getKeyCount() == 0) {
+        lo = 1;
+        hi = 0;
+    }
+}
+
+// answer the query by reading the keys in [lo, hi] from the index.
+// the table is read only when the value of a tuple is needed.
+static RC indexSelect(int attr, const string &table, const vector<SelCond> &cond,
+                      const RecordFile &rf, BTreeIndex &idx, int lo, int hi,
+                      ResultSink &out) {
+    RC rc;
+    vector<int> keys;
+    vector<RecordId> rids;
+    vector<int> rows;
+    int key;
+    string value;
+    int count = 0;
+    SelFilter filter(cond);
+
+    bool needValue = (attr == 2 || attr == 3 || filter.hasValueConds());
+
+    if (lo <= hi) {
+        // the scan reads the leaves of the range ahead of time
+        IndexScan scan(idx, lo, hi);
+        rf.advise(PageFile::RANDOM);
+
+        while ((rc = scan.next(keys, rids)) == 0) {
+            // the tuples whose keys fail are not read from the table
+            filter.selectKeys(keys.data(), keys.size(), rows);
+            for (unsigned i = 0; i < rows.size(); i++) {
+                key = keys[rows[i]];
+                if (needValue && (rc = rf.read(rids[rows[i]], key, value)) < 0) goto read_error;
+
+                if (filter.match(key, value)) {
+                    count++;
+                    out.writeTuple(attr, key, value);
+                }
             }
         }
+        if (rc != RC_END_OF_TREE) goto read_error;
+    }
 
-        // the condition is met for the tuple.
-        // increase matching tuple counter
-        count++;
+    // print matching tuple count if "select count(*)"
+    if (attr == 4) {
+        out.writeCount(count);
+    }
+    return 0;
 
-        // print the tuple
-        switch (attr) {
-            case 1:  // SELECT key
-                fprintf(stdout, "%d\n", key);
-                break;
-            case 2:  // SELECT value
-                fprintf(stdout, "%s\n", value.c_str());
-                break;
-            case 3:  // SELECT *
-                fprintf(stdout, "%d '%s'\n", key, value.c_str());
-                break;
+    read_error:
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+}
+
+// answer the query by reading the values in [lo, hi] from the value index.
+// lo or hi is NULL if the range is open on that side. the tuples are read
+// from the table for their keys, and checked against all conditions since
+// the index holds only a prefix of a long value.
+static RC valueIndexSelect(int attr, const string &table, const vector<SelCond> &cond,
+                           const RecordFile &rf, StringIndex &idx, const char *lo,
+                           const char *hi, ResultSink &out) {
+    RC rc;
+    StringCursor cursor;
+    vector<string> values;
+    vector<RecordId> rids;
+    int key;
+    string value;
+    string last(hi != NULL ? hi : "");
+    int count = 0;
+    SelFilter filter(cond);
+
+    if (lo == NULL || hi == NULL || strcmp(lo, hi) <= 0) {
+        if ((rc = idx.locate(lo != NULL ? lo : "", cursor)) < 0) goto read_error;
+        rf.advise(PageFile::RANDOM);
+
+        while ((rc = idx.readLeafEntries(cursor, hi != NULL ? &last : NULL, values, rids)) == 0) {
+            for (unsigned i = 0; i < rids.size(); i++) {
+                if ((rc = rf.read(rids[i], key, value)) < 0) goto read_error;
+
+                if (filter.match(key, value)) {
+                    count++;
+                    out.writeTuple(attr, key, value);
+                }
+            }
         }
+        if (rc != RC_END_OF_TREE) goto read_error;
+    }
+
+    // print matching tuple count if "select count(*)"
+    if (attr == 4) {
+        out.writeCount(count);
+    }
+    return 0;
+
+    read_error:
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+}
+
+// answer a query that needs nothing but the keys from the leaves of the
+// index alone. the table file is not even opened.
+static RC indexOnlySelect(int attr, const string &table, const vector<SelCond> &cond,
+                          BTreeIndex &idx, bool covered, int lo, int hi, ResultSink &out) {
+    RC rc;
+    IndexCursor cursor;
+    vector<int> keys;
+    vector<int> rows;
+    int count = 0;
+    SelFilter filter(cond);
 
-        // move to the next tuple
-        next_tuple:
-        ++rid;
+    // count(*) of the whole table is recorded in the metadata
+    // of an index known to have all tuples of the table
+    if (attr == 4 && cond.empty() && covered && idx.getKeyCount() >= 0) {
+        out.writeCount(idx.getKeyCount());
+        return 0;
+    }
+
+    if (lo <= hi) {
+        rc = idx.locate(lo, cursor);
+        if (rc < 0 && rc != RC_NO_SUCH_RECORD) goto read_error;
+
+        while ((rc = idx.readLeafKeys(cursor, hi, keys)) == 0) {
+            filter.selectKeys(keys.data(), keys.size(), rows);
+            count += rows.size();
+            if (attr == 1) {
+                for (unsigned i = 0; i < rows.size(); i++) {
+                    out.writeTuple(1, keys[rows[i]], string_view());
+                }
+            }
+        }
+        if (rc != RC_END_OF_TREE) goto read_error;
     }
 
     // print matching tuple count if "select count(*)"
     if (attr == 4) {
-        fprintf(stdout, "%d\n", count);
+        out.writeCount(count);
+    }
+    return 0;
+
+    read_error:
+    fprintf(stderr, "Error: while reading the index of table %s\n", table.c_str());
+    return rc;
+}
+
+// open an index of the table for a SELECT. an index that recorded another
+// end of the table misses the tuples appended since, and is not used.
+// older index files do not record it.
+template <class Index>
+static RC openIndex(Index &idx, const string &filename, const RecordFile &rf) {
+    RC rc;
+    if ((rc = idx.open(filename, 'r')) < 0) return rc;
+
+    const RecordId &end = idx.getTableEnd();
+    if (end.pid >= 0 && end != rf.endRid()) {
+        idx.close();
+        return RC_INVALID_FILE_FORMAT;
+    }
+    return 0;
+}
+
+RC SqlEngine::select(int attr, const string &table, const vector<SelCond> &cond) {
+    RecordFile rf;   // RecordFile containing the table
+    BTreeIndex idx;  // the index on the key column of the table
+    StringIndex vidx;  // the index on the value column of the table
+    ResultSink out(STDOUT_FILENO, ResultSink::defaultFormat());  // the result rows
+
+    RC rc;
+    int lo, hi;
+    const char *vlo, *vhi;
+    bool hasRange = keyRange(cond, lo, hi);
+    bool hasValueRange = valueRange(cond, vlo, vhi);
+
+    // open the table file
+    if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+        fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+        return rc;
+    }
+
+    // SELECT key or count(*) with conditions on the key alone
+    // can be answered from the index without reading the table
+    bool keyOnly = (attr == 1 || attr == 4);
+    for (unsigned i = 0; i < cond.size(); i++) {
+        if (cond[i].attr != 1) keyOnly = false;
+    }
+    if (keyOnly && openIndex(idx, table + ".idx", rf) == 0) {
+        pruneKeyRange(idx, lo, hi);
+        rc = indexOnlySelect(attr, table, cond, idx, idx.getTableEnd() == rf.endRid(), lo, hi, out);
+        idx.close();
+        rf.close();
+        RC orc = out.flush();
+        return (rc < 0) ? rc : orc;
+    }
+
+    // use the index if there is one and the conditions restrict the key,
+    // or the value index if the conditions restrict the value
+    if (hasRange && openIndex(idx, table + ".idx", rf) == 0) {
+        pruneKeyRange(idx, lo, hi);
+        rc = indexSelect(attr, table, cond, rf, idx, lo, hi, out);
+        idx.close();
+    } else if (hasValueRange && openIndex(vidx, table + ".vidx", rf) == 0) {
+        rc = valueIndexSelect(attr, table, cond, rf, vidx, vlo, vhi, out);
+        vidx.close();
+    } else {
+        rc = scanSelect(attr, table, cond, rf, out);
     }
-    rc = 0;
 
     // close the table file and return
-    exit_select:
     rf.close();
+    RC orc = out.flush();
+    return (rc < 0) ? rc : orc;
+}
+
+// the fill factor of the nodes of a bulk-loaded index.
+// BRUINBASE_FILL_FACTOR overrides the default.
+static double indexFillFactor() {
+    const char *s = getenv("BRUINBASE_FILL_FACTOR");
+    if (s != NULL && atof(s) > 0 && atof(s) <= 1) return atof(s);
+    return 0.9;
+}
+
+// whether a bulk-loaded index gets packed leaves.
+// BRUINBASE_PACKED_LEAVES=1 turns them on.
+static bool packedLeaves() {
+    const char *s = getenv("BRUINBASE_PACKED_LEAVES");
+    return s != NULL && atoi(s) != 0;
+}
+
+// the format of a new table file.
+// BRUINBASE_COLUMNAR=1 stores the keys and the values in separate pages.
+static RecordFile::Format tableFormat() {
+    const char *s = getenv("BRUINBASE_COLUMNAR");
+    return (s != NULL && atoi(s) != 0) ? RecordFile::COLUMNAR : RecordFile::SLOTTED;
+}
+
+// the memory budget for sorting index keys during a bulk load.
+// BRUINBASE_SORT_MB overrides the default.
+static size_t sortBudget() {
+    double mb = KeySorter::DEFAULT_SORT_MB;
+    const char *s = getenv("BRUINBASE_SORT_MB");
+    if (s != NULL && atof(s) > 0) mb = atof(s);
+    return (size_t)(mb * 1024 * 1024);
+}
+
+// an index filled by a load. a new index is built bottom-up from the
+// sorted keys. keys added to an existing index are inserted one by one.
+struct LoadIndex {
+    BTreeIndex idx;
+    KeySorter sorter;
+    string filename;
+    bool bulk;         // true if the index is built bottom-up
+    RC rc;             // the first error in filling the index. 0 if none
+
+    LoadIndex(size_t sortBudget) : sorter(sortBudget), bulk(false), rc(0) {}
+};
+
+// the value index filled by a load. the values are inserted one by one.
+struct LoadValueIndex {
+    StringIndex idx;
+    string filename;
+    bool fresh;        // true if the index starts out empty
+    RC rc;             // the first error in filling the index. 0 if none
+
+    LoadValueIndex() : fresh(false), rc(0) {}
+};
+
+// remove an index that could not be filled completely, so that
+// queries do not use it
+static void removeFailedIndex(const char *what, const string &filename) {
+    cout << "Failed to build the " << what << "; " << filename << " is removed" << '\n';
+    unlink(filename.c_str());
+}
+
+// open an index to be filled by a load. an index with keys that does not
+// record the end of the table as it is now misses some of its tuples, or
+// may, and is built again from the table.
+static RC openLoadIndex(LoadIndex &li, const string &filename, const RecordId &tableEnd) {
+    RC rc;
+    if ((rc = li.idx.open(filename, 'w')) < 0) return rc;
+    if (li.idx.getKeyCount() != 0 && li.idx.getTableEnd() != tableEnd) {
+        li.idx.close();
+        unlink(filename.c_str());
+        if ((rc = li.idx.open(filename, 'w')) < 0) return rc;
+    }
+    li.filename = filename;
+    li.bulk = (li.idx.bulkLoadBegin(indexFillFactor(), packedLeaves()) == 0);
+    return 0;
+}
+
+// add a (key, rid) pair of a loaded tuple to the index.
+// after the first error, the index is not filled any more.
+static void addLoadKey(LoadIndex &li, int key, const RecordId &rid) {
+    if (li.rc < 0) return;
+    if (li.bulk) {
+        if ((li.rc = li.sorter.add(key, rid)) < 0) {
+            cout << "Failed to sort the keys of the index" << '\n';
+        }
+    } else if ((li.rc = li.idx.insert(key, rid)) < 0) {
+        cout << "Failed to insert key " << key << " into the index" << '\n';
+    }
+}
+
+// build a bulk-loaded index from the sorted keys and close the index.
+// an index that could not be filled completely is removed.
+static RC closeLoadIndex(LoadIndex &li) {
+    RC rc;
+    if (li.bulk && li.rc == 0) {
+        int key;
+        RecordId recordId;
+        rc = li.sorter.sort();
+        while (rc == 0 && (rc = li.sorter.next(key, recordId)) == 0) {
+            if ((rc = li.idx.bulkLoadAppend(key, recordId)) < 0) {
+                cout << "Failed to insert key " << key << " into the index" << '\n';
+            }
+        }
+        if (rc == RC_END_OF_FILE) rc = li.idx.bulkLoadEnd();
+        if (rc < 0) li.rc = rc;
+    }
+    if ((rc = li.idx.close()) < 0 && li.rc == 0) li.rc = rc;
+
+    if (li.rc < 0) removeFailedIndex("index", li.filename);
+    return li.rc;
+}
+
+// open the value index to be filled by a load. a value index of an older
+// format, keyed by the first bytes of the values, or one that does not
+// record the end of the table as it is now, is replaced by a new one.
+static RC openLoadValueIndex(LoadValueIndex &li, const string &filename, const RecordId &tableEnd) {
+    RC rc;
+    li.filename = filename;
+    li.fresh = access(filename.c_str(), F_OK) != 0;
+    rc = li.idx.open(filename, 'w');
+    if (rc == 0 && !li.fresh && li.idx.getTableEnd() != tableEnd) {
+        li.idx.close();
+        rc = RC_INVALID_FILE_FORMAT;
+    }
+    if (rc == RC_INVALID_FILE_FORMAT) {
+        unlink(filename.c_str());
+        li.fresh = true;
+        rc = li.idx.open(filename, 'w');
+    }
     return rc;
 }
 
-RC SqlEngine::load(const string &table, const string &loadfile, bool index) {
+// add a (value, rid) pair of a loaded tuple to the value index.
+// after the first error, the index is not filled any more.
+static void addLoadValue(LoadValueIndex &li, string_view value, const RecordId &rid) {
+    if (li.rc < 0) return;
+    if ((li.rc = li.idx.insert(value, rid)) < 0) {
+        cout << "Failed to insert a value into the value index" << '\n';
+    }
+}
+
+// close the value index. an index that could not be filled completely
+// is removed.
+static RC closeLoadValueIndex(LoadValueIndex &li) {
+    RC rc;
+    if ((rc = li.idx.close()) < 0 && li.rc == 0) li.rc = rc;
+    if (li.rc < 0) removeFailedIndex("value index", li.filename);
+    return li.rc;
+}
+
+// add the tuples already in the table to the indexes that are new.
+// keyIndex or valIndex is NULL if that index needs no tuples.
+static RC addTableKeys(const RecordFile &rf, LoadIndex *keyIndex, LoadValueIndex *valIndex) {
+    RC rc;
+    RecordBatch batch;
+    const RecordId &erid = rf.endRid();
+
+    for (PageId pid = 0; pid <= erid.pid; pid++) {
+        if (pid == erid.pid && erid.sid == 0) break;
+        if ((rc = rf.readPage(pid, batch, valIndex != NULL)) < 0) return rc;
+        for (int i = 0; i < batch.count; i++) {
+            RecordId rid = { pid, i };
+            if (keyIndex != NULL) addLoadKey(*keyIndex, batch.keys[i], rid);
+            if (valIndex != NULL) addLoadValue(*valIndex, batch.values[i], rid);
+        }
+    }
+    return 0;
+}
+
+RC SqlEngine::load(const string &table, const string &loadfile, bool index, bool valueIndex) {
     string line;
     ifstream myfile(loadfile.c_str());
     int count = 0;
     if (myfile.is_open()) {
         RecordFile recordFile;
-        recordFile.open(table + ".tbl", 'w');
-        while (getline(myfile, line)) {
+        RC rc;
+
+        // an index that the table already has is kept up to date
+        // even if the load does not ask for it
+        index = index || access((table + ".idx").c_str(), F_OK) == 0;
+        valueIndex = valueIndex || access((table + ".vidx").c_str(), F_OK) == 0;
+
+        LoadIndex keyIndex(sortBudget());
+        LoadValueIndex valIndex;
+        if ((rc = recordFile.open(table + ".tbl", 'w', tableFormat())) < 0) {
+            cout << "Failed to open the table file";
+            return rc;
+        }
+        if (index && openLoadIndex(keyIndex, table + ".idx", recordFile.endRid()) < 0) {
+            cout << "Failed to open the index file";
+            recordFile.close();
+            return RC_FILE_OPEN_FAILED;
+        }
+        if (valueIndex && openLoadValueIndex(valIndex, table + ".vidx", recordFile.endRid()) < 0) {
+            cout << "Failed to open the value index file" << '\n';
+            // a key index this load just created would be left empty
+            if (index) {
+                if (keyIndex.bulk) keyIndex.rc = RC_FILE_OPEN_FAILED;
+                closeLoadIndex(keyIndex);
+            }
+            recordFile.close();
+            return RC_FILE_OPEN_FAILED;
+        }
+
+        // a new index of a table with tuples starts with those tuples.
+        // a new index missing some of them is removed when it is closed.
+        LoadIndex *newKeyIndex = (index && keyIndex.bulk) ? &keyIndex : NULL;
+        LoadValueIndex *newValIndex = (valueIndex && valIndex.fresh) ? &valIndex : NULL;
+        if ((newKeyIndex != NULL || newValIndex != NULL) &&
+            (rc = addTableKeys(recordFile, newKeyIndex, newValIndex)) < 0) {
+            cout << "Failed to read the tuples of table " << table << '\n';
+            if (newKeyIndex != NULL) newKeyIndex->rc = rc;
+            if (newValIndex != NULL) newValIndex->rc = rc;
+        }
+
+        while (rc == 0 && getline(myfile, line)) {
             RecordId recordId;
             int key = 0;
             string value;
             parseLoadLine(line, key, value);
-            recordFile.append(key, value, recordId);
+            if ((rc = recordFile.append(key, value, recordId)) < 0) {
+                cout << "Failed to append a tuple to table " << table << '\n';
+                break;
+            }
+            if (index) addLoadKey(keyIndex, key, recordId);
+            if (valueIndex) addLoadValue(valIndex, value, recordId);
             count++;
         }
         myfile.close();
-        recordFile.close();
+
+        // the indexes have all tuples of the table as it ends now
+        if (index) keyIndex.idx.setTableEnd(recordFile.endRid());
+        if (valueIndex) valIndex.idx.setTableEnd(recordFile.endRid());
+
+        // report the first error of the table and the indexes. the indexes
+        // may refer to tuples lost by a failed close of the table.
+        RC crc = recordFile.close();
+        if (crc < 0) {
+            if (rc == 0) rc = crc;
+            if (keyIndex.rc == 0) keyIndex.rc = crc;
+            if (valIndex.rc == 0) valIndex.rc = crc;
+        }
+        if (index && (crc = closeLoadIndex(keyIndex)) < 0 && rc == 0) rc = crc;
+        if (valueIndex && (crc = closeLoadValueIndex(valIndex)) < 0 && rc == 0) rc = crc;
         cout << count << " tuples loaded." << '\n';
         if (myfile.is_open()){
             cout << "Failed to close file";
             return RC_FILE_CLOSE_FAILED;
         }
-        return 0;
+        return rc;
     } else {
         cout << "Failed to open file";
         return RC_FILE_OPEN_FAILED;
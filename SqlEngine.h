@@ -52,12 +52,20 @@ class SqlEngine {
 
   /**
    * load a table from a load file.
+   * the tuples are appended to the table. an index created by the load
+   * also gets the tuples that the table already had, and an index that
+   * the table already has gets the new tuples whether asked for or not.
+   * the index on the value column is a StringIndex, which keeps a long
+   * value as a prefix, so a lookup through it checks the value of each
+   * tuple it finds in the table.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param valueIndex[IN] true if "WITH VALUE INDEX" option was specified
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC load(const std::string& table, const std::string& loadfile, bool index,
+                 bool valueIndex = false);
 
   /**
    * parse a line from the load file into the (key, value) pair.
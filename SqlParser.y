@@ -42,10 +42,13 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
 
-%type <integer> attributes attribute comparator
+%type <integer> attributes attribute comparator indexes index
 %type <string> table value
 %type <cond> condition
 %type <conds> conditions
+
+/* the strings of a command dropped by a syntax error */
+%destructor { free($$); } <string>
 %%
 
 commands:
@@ -71,13 +74,33 @@ load_command:
 	  free($2);
 	  free($4);
 	}
-	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
+	| LOAD table FROM STRING WITH indexes LF { 
+	  SqlEngine::load(std::string($2), std::string($4), ($6 & 1) != 0, ($6 & 2) != 0); 
 	  free($2);
 	  free($4);
 	}
 	;
 
+indexes:
+	index { $$ = $1; }
+	| indexes COMMA index { $$ = $1 | $3; }
+	;
+
+index:
+	INDEX { $$ = 1; }
+	| ID INDEX {
+		if (strcasecmp($1, "key") == 0) $$=1;
+		else if (strcasecmp($1, "value") == 0) $$=2;
+		else {
+			// the load is not run with a misspelled index
+			sqlerror("wrong index name. neither key or value");
+			free($1);
+			YYERROR;
+		}
+		free($1);
+	}
+	;
+
 select_command:
 	SELECT attributes FROM table LF {
    	        std::vector<SelCond> conds;
@@ -128,7 +151,11 @@ attribute:
 	ID { 
 		if (strcasecmp($1, "key") == 0) $$=1;
 		else if (strcasecmp($1, "value") == 0) $$=2;
-		else sqlerror("wrong attribute name. neither key or value");
+		else {
+			sqlerror("wrong attribute name. neither key or value");
+			free($1);
+			YYERROR;
+		}
 		free($1);
 	}
 
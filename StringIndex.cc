@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "StringIndex.h"
+#include "BTreeNode.h"
+#include <cstring>
+
+using namespace std;
+
+/*
+ * The layout of page 0 of the index file. The format sits where the
+ * format version of a BTreeIndex file is, so that a value index of the
+ * older format, keyed by the first four bytes of the values, is told
+ * apart.
+ */
+struct StringIndexMeta {
+    PageId   rootPid;
+    int      treeHeight;
+    int      format;      // STRING_INDEX_FORMAT
+    int      pageSize;    // the page size of the file
+    RecordId tableEnd;    // the end of the table when the index was last
+                          //   updated. (-1, -1) if not known
+};
+
+static const int STRING_INDEX_FORMAT = 0x53544931;
+
+StringIndex::StringIndex()
+{
+    rootPid = -1;
+    treeHeight = 0;
+    tableEnd.pid = tableEnd.sid = -1;
+    writable = false;
+}
+
+/*
+ * Open the index file in read or write mode.
+ * Under 'w' mode, the index file should be created if it does not exist.
+ * @param indexname[IN] the name of the index file
+ * @param mode[IN] 'r' for read, 'w' for write
+ * @return error code. 0 if no error
+ */
+RC StringIndex::open(const string& indexname, char mode)
+{
+    RC rc;
+    if ((rc = pf.open(indexname, mode)) < 0) {
+        return rc;
+    }
+    writable = (mode == 'w' || mode == 'W');
+
+    // a new index file. reserve page 0 for the metadata.
+    rootPid = -1;
+    treeHeight = 0;
+    tableEnd.pid = tableEnd.sid = -1;
+    if (pf.endPid() == 0) {
+        if (writable && (rc = writeMeta()) < 0) {
+            pf.close();
+            return rc;
+        }
+        return 0;
+    }
+
+    // read the metadata from page 0
+    PageHandle page;
+    if ((rc = pf.fetch(0, page)) < 0) {
+        pf.close();
+        return rc;
+    }
+    StringIndexMeta meta;
+    memcpy(&meta, page.data(), sizeof(meta));
+    page.unpin();
+
+    if (meta.format != STRING_INDEX_FORMAT || meta.pageSize != pf.getPageSize()) {
+        writable = false;
+        pf.close();
+        return RC_INVALID_FILE_FORMAT;
+    }
+    rootPid = meta.rootPid;
+    treeHeight = meta.treeHeight;
+    tableEnd = meta.tableEnd;
+
+    // index lookups jump around the file; do not read ahead
+    pf.advise(PageFile::RANDOM);
+    return 0;
+}
+
+/*
+ * Close the index file.
+ * @return error code. 0 if no error
+ */
+RC StringIndex::close()
+{
+    RC rc = 0;
+    if (writable) {
+        rc = writeMeta();
+    }
+    RC crc = pf.close();
+    writable = false;
+    return (rc < 0) ? rc : crc;
+}
+
+/*
+ * Store the metadata of the tree in page 0 of the index file.
+ * @return error code. 0 if no error
+ */
+RC StringIndex::writeMeta()
+{
+    RC rc;
+    PageHandle page;
+    if ((rc = pf.fetchNew(0, page)) < 0) {
+        return rc;
+    }
+    StringIndexMeta meta;
+    meta.rootPid = rootPid;
+    meta.treeHeight = treeHeight;
+    meta.format = STRING_INDEX_FORMAT;
+    meta.pageSize = pf.getPageSize();
+    meta.tableEnd = tableEnd;
+    memset(page.data(), 0, pf.getPageSize());
+    memcpy(page.data(), &meta, sizeof(meta));
+    page.markDirty();
+    return 0;
+}
+
+/*
+ * @return the longest key stored in full
+ */
+int StringIndex::getMaxKeyLength() const
+{
+    return BTStringNode::getMaxKeyLength(pf.getPageSize());
+}
+
+/*
+ * Insert (key, RecordId) pair to the index.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
+ */
+RC StringIndex::insert(string_view key, const RecordId& rid)
+{
+    RC rc;
+    key = key.substr(0, getMaxKeyLength());
+
+    // the first key makes a leaf the root
+    if (rootPid < 0) {
+        BTStringLeafNode leaf(pf.getPageSize());
+        PageId pid = pf.endPid();
+        if ((rc = leaf.insert(key, rid)) < 0 || (rc = leaf.write(pid, pf)) < 0) {
+            return rc;
+        }
+        rootPid = pid;
+        treeHeight = 1;
+        return 0;
+    }
+
+    // a split of the root makes a new root above it
+    string splitKey;
+    PageId splitPid;
+    if ((rc = insertInto(rootPid, 1, key, rid, splitKey, splitPid)) < 0) {
+        return rc;
+    }
+    if (splitPid >= 0) {
+        BTStringNonLeafNode root(pf.getPageSize());
+        PageId pid = pf.endPid();
+        root.initializeRoot(rootPid, splitKey, splitPid);
+        if ((rc = root.write(pid, pf)) < 0) {
+            return rc;
+        }
+        rootPid = pid;
+        treeHeight++;
+    }
+    return 0;
+}
+
+/*
+ * Insert (key, rid) into the subtree rooted at pid.
+ * @param pid[IN] the root of the subtree
+ * @param level[IN] the level of pid. 1 for the root
+ * @param key[IN] the key to insert
+ * @param rid[IN] the RecordId to insert
+ * @param splitKey[OUT] the separator of pid and its new sibling
+ * @param splitPid[OUT] the new sibling of pid. -1 if pid did not split
+ * @return error code. 0 if no error
+ */
+RC StringIndex::insertInto(PageId pid, int level, string_view key, const RecordId& rid,
+                           string& splitKey, PageId& splitPid)
+{
+    RC rc;
+    splitPid = -1;
+
+    if (level == treeHeight) {
+        BTStringLeafNode leaf(pf.getPageSize());
+        if ((rc = leaf.read(pid, pf)) < 0) {
+            return rc;
+        }
+        if ((rc = leaf.insert(key, rid)) == 0) {
+            return leaf.write(pid, pf);
+        }
+
+        // the leaf is full. split it and link the new sibling
+        // into the leaf chain.
+        BTStringLeafNode sibling(pf.getPageSize());
+        PageId siblingPid = pf.endPid();
+        if ((rc = leaf.insertAndSplit(key, rid, sibling, splitKey)) < 0) {
+            return rc;
+        }
+        sibling.setNextNodePtr(leaf.getNextNodePtr());
+        leaf.setNextNodePtr(siblingPid);
+        if ((rc = sibling.write(siblingPid, pf)) < 0 || (rc = leaf.write(pid, pf)) < 0) {
+            return rc;
+        }
+        splitPid = siblingPid;
+        return 0;
+    }
+
+    BTStringNonLeafNode node(pf.getPageSize());
+    int eid;
+    PageId child;
+    string childKey;
+    PageId childPid;
+    if ((rc = node.read(pid, pf)) < 0 ||
+        (rc = node.locateChildPtr(key, eid, child)) < 0 ||
+        (rc = insertInto(child, level + 1, key, rid, childKey, childPid)) < 0) {
+        return rc;
+    }
+    if (childPid < 0) {
+        return 0;
+    }
+
+    // the child split. its new sibling goes right behind it.
+    if ((rc = node.insert(eid, childKey, childPid)) == 0) {
+        return node.write(pid, pf);
+    }
+    BTStringNonLeafNode sibling(pf.getPageSize());
+    PageId siblingPid = pf.endPid();
+    if ((rc = node.insertAndSplit(eid, childKey, childPid, sibling, splitKey)) < 0 ||
+        (rc = sibling.write(siblingPid, pf)) < 0 || (rc = node.write(pid, pf)) < 0) {
+        return rc;
+    }
+    splitPid = siblingPid;
+    return 0;
+}
+
+/*
+ * Set the cursor to the first entry whose key is not smaller than searchKey.
+ * @param searchKey[IN] the key to find
+ * @param cursor[OUT] the cursor pointing to the entry
+ * @return error code. 0 if no error
+ */
+RC StringIndex::locate(string_view searchKey, StringCursor& cursor)
+{
+    RC rc;
+    PageId pid = rootPid;
+    searchKey = searchKey.substr(0, getMaxKeyLength());
+
+    cursor.pid = -1;
+    cursor.eid = 0;
+    if (pid < 0) {
+        return 0;
+    }
+
+    // the separators smaller than the key lead to the leftmost leaf
+    // that may hold it
+    BTStringNonLeafNode node(pf.getPageSize());
+    for (int level = 1; level < treeHeight; level++) {
+        int eid;
+        if ((rc = node.read(pid, pf)) < 0 || (rc = node.locateChildPtr(searchKey, eid, pid)) < 0) {
+            return rc;
+        }
+    }
+
+    BTStringLeafNode leaf(pf.getPageSize());
+    if ((rc = leaf.read(pid, pf)) < 0) {
+        return rc;
+    }
+    cursor.pid = pid;
+    leaf.locate(searchKey, cursor.eid);
+    return 0;
+}
+
+/*
+ * Read the (key, rid) pairs from the cursor location to the end of its
+ * leaf node, stopping at the first key larger than hi.
+ * @param cursor[IN/OUT] the cursor pointing to a leaf-node entry
+ * @param hi[IN] the largest key to read. NULL to read to the end
+ * @param keys[OUT] the keys read, in ascending order
+ * @param rids[OUT] rids[i] is the RecordId of keys[i]
+ * @return error code. RC_END_OF_TREE if there is no key <= hi left
+ */
+RC StringIndex::readLeafEntries(StringCursor& cursor, const string* hi,
+                                vector<string>& keys, vector<RecordId>& rids)
+{
+    RC rc;
+    BTStringLeafNode leaf(pf.getPageSize());
+
+    // a key cut to its prefix is not larger than the prefix of hi
+    string_view last;
+    if (hi != NULL) {
+        last = string_view(*hi).substr(0, getMaxKeyLength());
+    }
+
+    keys.clear();
+    rids.clear();
+    while (cursor.pid > 0) {
+        if ((rc = leaf.read(cursor.pid, pf)) < 0) {
+            return rc;
+        }
+        int keyCount = leaf.getKeyCount();
+        for (; cursor.eid < keyCount; cursor.eid++) {
+            if (hi != NULL && leaf.getKey(cursor.eid) > last) {
+                // no more keys in range. leave the cursor at the end.
+                cursor.pid = -1;
+                cursor.eid = 0;
+                return keys.empty() ? RC_END_OF_TREE : 0;
+            }
+            keys.emplace_back();
+            rids.emplace_back();
+            leaf.readEntry(cursor.eid, keys.back(), rids.back());
+        }
+
+        // move to the next leaf. an empty read goes on to it.
+        cursor.pid = leaf.getNextNodePtr();
+        cursor.eid = 0;
+        if (!keys.empty()) {
+            return 0;
+        }
+    }
+    return RC_END_OF_TREE;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef STRINGINDEX_H
+#define STRINGINDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+
+/**
+ * The position of an entry in the leaves of a StringIndex.
+ */
+typedef struct {
+  // PageId of the leaf. -1 past the last leaf
+  PageId  pid;
+  // The entry number inside the leaf
+  int     eid;
+} StringCursor;
+
+/**
+ * A B+tree index on strings, used for the value column of a table.
+ * The leaves hold a (key, RecordId) entry for every record, in key order,
+ * so a key with several records appears in several entries, which may
+ * span leaves. A value longer than getMaxKeyLength() is stored as its
+ * prefix of that length; since a prefix keeps the order of the values,
+ * a lookup still finds every record in its range, along with records
+ * whose values only share the prefix, which the caller checks.
+ * The non-leaf nodes hold the shortest separators that tell their
+ * children apart, rather than whole keys (see BTStringLeafNode::
+ * insertAndSplit()).
+ * An index is used by one thread at a time.
+ */
+class StringIndex {
+ public:
+  StringIndex();
+
+  /**
+   * Open the index file in read or write mode.
+   * Under 'w' mode, the index file should be created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. RC_INVALID_FILE_FORMAT if the file is not a
+   *         StringIndex, e.g. a value index of an older format
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * Close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert (key, RecordId) pair to the index.
+   * A key already in the index gets another entry behind its others.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC insert(std::string_view key, const RecordId& rid);
+
+  /**
+   * Set the cursor to the first entry whose key is not smaller than
+   * searchKey, or past the last entry if there is none.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return error code. 0 if no error
+   */
+  RC locate(std::string_view searchKey, StringCursor& cursor);
+
+  /**
+   * Read the (key, rid) pairs from the cursor location to the end of its
+   * leaf node, stopping at the first key larger than hi, and move the
+   * cursor to the next leaf.
+   * @param cursor[IN/OUT] the cursor pointing to a leaf-node entry
+   * @param hi[IN] the largest key to read. NULL to read to the end
+   * @param keys[OUT] the keys read, in ascending order
+   * @param rids[OUT] rids[i] is the RecordId of keys[i]
+   * @return error code. RC_END_OF_TREE if there is no key <= hi left
+   */
+  RC readLeafEntries(StringCursor& cursor, const std::string* hi,
+                     std::vector<std::string>& keys, std::vector<RecordId>& rids);
+
+  /**
+   * Record the end of the table when the index has all of its tuples.
+   * It is stored in the metadata when the index is closed, so that a
+   * reader can tell whether the table changed without the index.
+   * @param end[IN] the endRid() of the table
+   */
+  void setTableEnd(const RecordId& end) { tableEnd = end; }
+
+  /**
+   * Return the end of the table recorded by setTableEnd().
+   * @return the endRid() of the table covered by the index.
+   *         (-1, -1) if not known
+   */
+  const RecordId& getTableEnd() const { return tableEnd; }
+
+  /**
+   * @return the longest key stored in full. longer keys are cut to it
+   */
+  int getMaxKeyLength() const;
+
+ private:
+  /**
+   * Insert (key, rid) into the subtree rooted at pid.
+   * @param pid[IN] the root of the subtree
+   * @param level[IN] the level of pid. 1 for the root
+   * @param key[IN] the key to insert
+   * @param rid[IN] the RecordId to insert
+   * @param splitKey[OUT] the separator of pid and its new sibling
+   * @param splitPid[OUT] the new sibling of pid. -1 if pid did not split
+   * @return error code. 0 if no error
+   */
+  RC insertInto(PageId pid, int level, std::string_view key, const RecordId& rid,
+                std::string& splitKey, PageId& splitPid);
+
+  /**
+   * Store the metadata of the tree in page 0 of the index file.
+   * @return error code. 0 if no error
+   */
+  RC writeMeta();
+
+  PageFile pf;         /// the PageFile used to store the b+tree on disk
+  PageId   rootPid;    /// the PageId of the root node. -1 if empty
+  int      treeHeight; /// the height of the tree
+  RecordId tableEnd;   /// the end of the table covered. (-1, -1) if not known
+  /// The above variables are stored in page 0 of the index file
+  /// when the index is closed and read back when it is opened again.
+
+  bool     writable;   /// true if the index was opened in 'w' mode
+};
+
+#endif /* STRINGINDEX_H */
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <random>
+#include <thread>
+#include <vector>
+#include "BTreeIndex.h"
+#include "TestUtil.h"
+
+using namespace std;
+
+// read all (key, rid) pairs of the index from the first key on
+static void readAll(BTreeIndex& idx, vector<int>& keys, vector<RecordId>& rids)
+{
+  IndexCursor cursor;
+  int key;
+  RecordId rid;
+
+  keys.clear();
+  rids.clear();
+  idx.locate(INT_MIN, cursor);
+  while (idx.readForward(cursor, key, rid) == 0) {
+    keys.push_back(key);
+    rids.push_back(rid);
+  }
+}
+
+// check that two cursors read the same pairs for a few steps
+static bool sameEntries(BTreeIndex& idx, IndexCursor a, IndexCursor b)
+{
+  for (int step = 0; step < 3; step++) {
+    int keyA, keyB;
+    RecordId ridA, ridB;
+    RC rcA = idx.readForward(a, keyA, ridA);
+    RC rcB = idx.readForward(b, keyB, ridB);
+    if (rcA != rcB) return false;
+    if (rcA != 0) return true;
+    if (keyA != keyB || ridA != ridB) return false;
+  }
+  return true;
+}
+
+// locateBatch() gives every key the cursor locate() gives it, for keys
+// in any order, present or not, repeated, and outside the keys of the tree
+static void testLocateBatch()
+{
+  const int KEY_COUNT = 30000;
+  string filename = testFile("batch.idx");
+
+  // small pages make a tree deep enough to route through several levels
+  setenv("BRUINBASE_PAGE_SIZE", "1024", 1);
+  BTreeIndex idx;
+  CHECK_OK(idx.open(filename, 'w'));
+  unsetenv("BRUINBASE_PAGE_SIZE");
+
+  // a batch on an empty index finds nothing
+  int none[] = { 5, -3 };
+  IndexCursor cursors[2];
+  int key;
+  RecordId rid;
+  CHECK_OK(idx.locateBatch(none, 2, cursors));
+  CHECK(idx.readForward(cursors[0], key, rid) != 0);
+  CHECK_OK(idx.locateBatch(none, 0, cursors));
+
+  vector<int> keys(KEY_COUNT);
+  for (int i = 0; i < KEY_COUNT; i++) keys[i] = i * 2;
+  shuffle(keys.begin(), keys.end(), mt19937(5));
+  for (int i = 0; i < KEY_COUNT; i++) {
+    RecordId r = { keys[i], i % 10 };
+    CHECK_OK(idx.insert(keys[i], r));
+  }
+  CHECK(idx.getTreeHeight() > 2);
+
+  mt19937 rnd(9);
+  int bad = 0;
+  for (int round = 0; round < 50; round++) {
+    int n = 1 + rnd() % 500;
+    vector<int> batch(n);
+    for (int i = 0; i < n; i++) {
+      batch[i] = (int) (rnd() % (2 * KEY_COUNT + 200)) - 100;
+      if (i > 0 && rnd() % 10 == 0) batch[i] = batch[i - 1];
+    }
+    if (round == 0) {
+      batch[0] = INT_MIN;
+      batch[n - 1] = INT_MAX;
+    }
+
+    vector<IndexCursor> out(n);
+    CHECK_OK(idx.locateBatch(batch.data(), n, out.data()));
+    for (int i = 0; i < n; i++) {
+      IndexCursor cursor;
+      idx.locate(batch[i], cursor);
+      if (!sameEntries(idx, out[i], cursor)) bad++;
+    }
+  }
+  CHECK(bad == 0);
+  CHECK_OK(idx.close());
+}
+
+// writers insert distinct keys while readers look up the keys already
+// inserted and scan ranges, which must always come out in order
+static void testConcurrentInsertAndScan()
+{
+  const int KEY_COUNT = 100000;
+  const int WRITERS = 4;
+  const int READERS = 4;
+
+  string filename = testFile("olc.idx");
+
+  BTreeIndex idx;
+  CHECK_OK(idx.open(filename, 'w'));
+
+  vector<int> keys(KEY_COUNT);
+  for (int i = 0; i < KEY_COUNT; i++) keys[i] = i * 3;
+  shuffle(keys.begin(), keys.end(), mt19937(7));
+
+  // writer w inserts keys[w], keys[w + WRITERS], ... and publishes
+  // how far it got
+  vector<atomic<int> > inserted(WRITERS);
+  for (int w = 0; w < WRITERS; w++) inserted[w] = 0;
+  atomic<bool> done(false);
+  atomic<int> errors(0);
+
+  vector<thread> threads;
+  for (int w = 0; w < WRITERS; w++) {
+    threads.push_back(thread([&, w]() {
+      for (int i = w; i < KEY_COUNT; i += WRITERS) {
+        RecordId rid = { keys[i], keys[i] % 7 };
+        if (idx.insert(keys[i], rid) != 0) errors++;
+        inserted[w] = i + WRITERS;
+      }
+    }));
+  }
+  for (int r = 0; r < READERS; r++) {
+    threads.push_back(thread([&, r]() {
+      mt19937 rnd(r);
+      while (!done) {
+        // a key inserted before the lookup started is found
+        int w = rnd() % WRITERS;
+        int count = (inserted[w] - w) / WRITERS;
+        if (count > 0) {
+          int i = w + WRITERS * (rnd() % count);
+          IndexCursor cursor;
+          int key;
+          RecordId rid;
+          if (idx.locate(keys[i], cursor) != 0 || idx.readForward(cursor, key, rid) != 0 ||
+              key != keys[i] || rid.pid != keys[i]) {
+            errors++;
+          }
+        }
+
+        // a scan sees ascending keys, each with its own RecordId
+        IndexCursor cursor;
+        int lo = (rnd() % KEY_COUNT) * 3;
+        int key, prev = INT_MIN;
+        RecordId rid;
+        idx.locate(lo, cursor);
+        for (int n = 0; n < 1000 && idx.readForward(cursor, key, rid) == 0; n++) {
+          if (key <= prev || key < lo || key % 3 != 0 || rid.pid != key) {
+            errors++;
+            break;
+          }
+          prev = key;
+        }
+      }
+    }));
+  }
+  for (int w = 0; w < WRITERS; w++) threads[w].join();
+  done = true;
+  for (unsigned t = WRITERS; t < threads.size(); t++) threads[t].join();
+  CHECK(errors == 0);
+
+  // every key is there once, and stays there after a reopen
+  vector<int> found;
+  vector<RecordId> rids;
+  readAll(idx, found, rids);
+  CHECK((int) found.size() == KEY_COUNT);
+  for (int i = 0; i < (int) found.size(); i++) {
+    if (found[i] != i * 3) {
+      CHECK(found[i] == i * 3);
+      break;
+    }
+  }
+  CHECK(idx.getKeyCount() == KEY_COUNT);
+  CHECK_OK(idx.close());
+
+  CHECK_OK(idx.open(filename, 'r'));
+  readAll(idx, found, rids);
+  CHECK((int) found.size() == KEY_COUNT);
+  CHECK_OK(idx.close());
+}
+
+// keys inserted several times keep all of their RecordIds in insertion
+// order, whether the list is a run of a shared posting page or has
+// outgrown it into a chain of its own
+static void testPostingLists()
+{
+  // the # of records of key k: one, a few (a run), many (a chain)
+  const int SIZES[] = { 1, 2, 5, 40, 3000 };
+  const int KEYS = sizeof(SIZES) / sizeof(SIZES[0]);
+  string filename = testFile("posting.idx");
+
+  BTreeIndex idx;
+  CHECK_OK(idx.open(filename, 'w'));
+
+  // interleave the inserts of the keys, so that their runs share pages
+  int sid = 0;
+  for (int round = 0; round < SIZES[KEYS - 1]; round++) {
+    for (int k = 0; k < KEYS; k++) {
+      if (round >= SIZES[k]) continue;
+      RecordId rid = { k, round };
+      CHECK_OK(idx.insert(k * 10, rid));
+      sid++;
+    }
+  }
+  CHECK(idx.getKeyCount() == sid);
+  CHECK_OK(idx.close());
+
+  CHECK_OK(idx.open(filename, 'r'));
+  vector<int> keys;
+  vector<RecordId> rids;
+  readAll(idx, keys, rids);
+  CHECK((int) keys.size() == sid);
+
+  unsigned n = 0;
+  for (int k = 0; k < KEYS; k++) {
+    for (int round = 0; round < SIZES[k] && n < keys.size(); round++, n++) {
+      if (keys[n] != k * 10 || rids[n].pid != k || rids[n].sid != round) {
+        CHECK(keys[n] == k * 10 && rids[n].pid == k && rids[n].sid == round);
+        k = KEYS;
+        break;
+      }
+    }
+  }
+
+  // a lookup of a duplicate key starts at its first record
+  IndexCursor cursor;
+  int key;
+  RecordId rid;
+  CHECK_OK(idx.locate(40, cursor));
+  CHECK_OK(idx.readForward(cursor, key, rid));
+  CHECK(key == 40 && rid.pid == 4 && rid.sid == 0);
+
+  // the leaves return a key once for each of its records
+  CHECK(idx.locate(15, cursor) == RC_NO_SUCH_RECORD);
+  CHECK_OK(idx.readLeafEntries(cursor, 30, keys, rids));
+  CHECK(count(keys.begin(), keys.end(), 20) == 5 && count(keys.begin(), keys.end(), 30) == 40);
+  CHECK_OK(idx.close());
+}
+
+// a bulk-loaded index with packed leaves returns what was loaded, and
+// keeps doing so after inserts that fit the packing and ones that do not
+static void testPackedLeaves()
+{
+  const int KEY_COUNT = 20000;
+  string filename = testFile("packed.idx");
+
+  BTreeIndex idx;
+  CHECK_OK(idx.open(filename, 'w'));
+  CHECK_OK(idx.bulkLoadBegin(0.9, true));
+
+  // dense keys with clustered RecordIds, a few duplicates and a gap
+  vector<pair<int, RecordId> > expected;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    int key = (i < KEY_COUNT / 2) ? i : i + 1000;
+    RecordId rid = { i / 50, i % 50 };
+    CHECK_OK(idx.bulkLoadAppend(key, rid));
+    expected.push_back(make_pair(key, rid));
+    if (i % 997 == 0) {
+      RecordId dup = { rid.pid + 5000, rid.sid };
+      CHECK_OK(idx.bulkLoadAppend(key, dup));
+      expected.push_back(make_pair(key, dup));
+    }
+  }
+  CHECK_OK(idx.bulkLoadEnd());
+  CHECK_OK(idx.close());
+
+  CHECK_OK(idx.open(filename, 'w'));
+  mt19937 rnd(3);
+  for (int n = 0; n < 2000; n++) {
+    int key = rnd() % (KEY_COUNT + 2000);
+    RecordId rid = { (int) (rnd() % 1000), (int) (rnd() % 50) };
+    CHECK_OK(idx.insert(key, rid));
+    expected.push_back(make_pair(key, rid));
+  }
+  CHECK_OK(idx.close());
+
+  // the RecordIds of a key may come in another order than expected
+  auto less = [](const pair<int, RecordId>& a, const pair<int, RecordId>& b) {
+    return a.first != b.first ? a.first < b.first : a.second < b.second;
+  };
+  sort(expected.begin(), expected.end(), less);
+
+  CHECK_OK(idx.open(filename, 'r'));
+  vector<int> keys;
+  vector<RecordId> rids;
+  readAll(idx, keys, rids);
+  vector<pair<int, RecordId> > found;
+  for (unsigned i = 0; i < keys.size(); i++) found.push_back(make_pair(keys[i], rids[i]));
+  sort(found.begin(), found.end(), less);
+  CHECK(found.size() == expected.size());
+  CHECK(equal(found.begin(), found.end(), expected.begin(),
+              [](const pair<int, RecordId>& a, const pair<int, RecordId>& b) {
+                return a.first == b.first && a.second == b.second;
+              }));
+
+  // a scan of a range reads the same pairs as the cursor
+  IndexScan scan(idx, 5000, 15000);
+  size_t scanned = 0;
+  RC rc;
+  while ((rc = scan.next(keys, rids)) == 0) {
+    for (unsigned i = 0; i < keys.size(); i++) CHECK(keys[i] >= 5000 && keys[i] <= 15000);
+    scanned += keys.size();
+  }
+  CHECK(rc == RC_END_OF_TREE);
+  size_t inRange = 0;
+  for (unsigned i = 0; i < expected.size(); i++) {
+    if (expected[i].first >= 5000 && expected[i].first <= 15000) inRange++;
+  }
+  CHECK(scanned == inRange);
+  CHECK_OK(idx.close());
+}
+
+int main()
+{
+  RUN_TEST(testLocateBatch);
+  RUN_TEST(testConcurrentInsertAndScan);
+  RUN_TEST(testPostingLists);
+  RUN_TEST(testPackedLeaves);
+
+  unlink("test_batch.idx");
+  unlink("test_olc.idx");
+  unlink("test_posting.idx");
+  unlink("test_packed.idx");
+  return testFailures;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <random>
+#include <string>
+#include <vector>
+#include "RecordFile.h"
+#include "TestUtil.h"
+
+using namespace std;
+
+// the value of record i: mostly short, some empty, a few longer than a page
+static string testValue(int i)
+{
+  if (i % 10 == 0) return string();
+  if (i % 97 == 0) return string(3 * PageFile::MAX_PAGE_SIZE + i % 13, 'a' + i % 26);
+  return "value " + to_string(i) + string(i % 40, 'x');
+}
+
+// append records, read them back one by one and a page at a time,
+// then reopen the file and append more
+static void roundTrip(RecordFile::Format format, const char* name)
+{
+  const int FIRST_COUNT = 3000;
+  const int TOTAL_COUNT = 5000;
+  string filename = testFile(name);
+  vector<RecordId> rids;
+
+  RecordFile rf;
+  CHECK_OK(rf.open(filename, 'w', format));
+  CHECK(rf.getFormat() == format);
+  for (int i = 0; i < FIRST_COUNT; i++) {
+    RecordId rid;
+    CHECK_OK(rf.append(i * 7 - 100, testValue(i), rid));
+    rids.push_back(rid);
+  }
+  CHECK_OK(rf.close());
+
+  // an existing file keeps its format whatever the open asks for
+  CHECK_OK(rf.open(filename, 'w', RecordFile::SLOTTED));
+  CHECK(rf.getFormat() == format);
+  for (int i = FIRST_COUNT; i < TOTAL_COUNT; i++) {
+    RecordId rid;
+    CHECK_OK(rf.append(i * 7 - 100, testValue(i), rid));
+    rids.push_back(rid);
+  }
+  CHECK_OK(rf.close());
+
+  CHECK_OK(rf.open(filename, 'r'));
+  int key;
+  string value;
+  int bad = 0;
+  for (int i = 0; i < TOTAL_COUNT; i++) {
+    if (rf.read(rids[i], key, value) != 0 || key != i * 7 - 100 || value != testValue(i)) bad++;
+  }
+  CHECK(bad == 0);
+
+  // the pages hold the records in the order they were appended. the
+  // values of a columnar page are read only for the rows asked for.
+  RecordBatch batch;
+  vector<int> rows;
+  const RecordId& end = rf.endRid();
+  int n = 0;
+  for (PageId pid = 0; pid <= end.pid; pid++) {
+    if (pid == end.pid && end.sid == 0) break;
+    CHECK_OK(rf.readPage(pid, batch, format != RecordFile::COLUMNAR));
+    rows.clear();
+    for (int i = 0; i < batch.count; i++) {
+      if (batch.keys[i] < batch.minKey || batch.keys[i] > batch.maxKey) bad++;
+      if (i % 2 == 0) rows.push_back(i);
+    }
+    CHECK_OK(rf.readValues(batch, rows));
+    for (unsigned r = 0; r < rows.size(); r++) {
+      int i = n + rows[r];
+      if (i >= TOTAL_COUNT || batch.keys[rows[r]] != i * 7 - 100 ||
+          batch.values[rows[r]] != testValue(i)) {
+        bad++;
+      }
+    }
+    n += batch.count;
+  }
+  CHECK(bad == 0);
+  CHECK(n == TOTAL_COUNT);
+  CHECK_OK(rf.close());
+  unlink(filename.c_str());
+}
+
+static void testSlottedRoundTrip()
+{
+  roundTrip(RecordFile::SLOTTED, "slotted.tbl");
+}
+
+static void testColumnarRoundTrip()
+{
+  roundTrip(RecordFile::COLUMNAR, "columnar.tbl");
+}
+
+int main()
+{
+  RUN_TEST(testSlottedRoundTrip);
+  RUN_TEST(testColumnarRoundTrip);
+  return testFailures;
+}
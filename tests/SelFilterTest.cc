@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <climits>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "SelFilter.h"
+#include "TestUtil.h"
+
+using namespace std;
+
+// check one condition the slow way
+static bool holds(const SelCond& cond, int key, string_view value)
+{
+  int c;
+  if (cond.attr == 1) {
+    long long v = atoi(cond.value);
+    c = (key < v) ? -1 : (key > v);
+  } else {
+    c = value.compare(cond.value);
+  }
+  switch (cond.comp) {
+    case SelCond::EQ: return c == 0;
+    case SelCond::NE: return c != 0;
+    case SelCond::LT: return c < 0;
+    case SelCond::GT: return c > 0;
+    case SelCond::LE: return c <= 0;
+    case SelCond::GE: return c >= 0;
+  }
+  return false;
+}
+
+static string randomValue(mt19937& rnd)
+{
+  string value;
+  int length = rnd() % 4;
+  for (int i = 0; i < length; i++) value += (char) ('a' + rnd() % 3);
+  return value;
+}
+
+// the kernels and match() select the tuples that satisfy every condition,
+// for random sets of conditions on random batches. the keys are drawn
+// from a small range, so that ranges, equalities and exclusions hit, and
+// include the ends of the int range.
+static void testKernels()
+{
+  mt19937 rnd(11);
+  const int BATCH = 300;
+  int bad = 0;
+
+  for (int round = 0; round < 2000; round++) {
+    vector<string> constants;
+    vector<SelCond> cond(rnd() % 5);
+    constants.reserve(cond.size());
+    for (unsigned i = 0; i < cond.size(); i++) {
+      cond[i].attr = 1 + rnd() % 2;
+      cond[i].comp = (SelCond::Comparator) (rnd() % 6);
+      if (cond[i].attr == 1) {
+        int v = (rnd() % 20 == 0) ? ((rnd() % 2) ? INT_MAX : INT_MIN) : (int) (rnd() % 64) - 32;
+        constants.push_back(to_string(v));
+      } else {
+        constants.push_back(randomValue(rnd));
+      }
+      cond[i].value = const_cast<char*>(constants.back().c_str());
+    }
+    SelFilter filter(cond);
+
+    vector<int> keys(BATCH);
+    vector<string> values(BATCH);
+    vector<string_view> views(BATCH);
+    for (int i = 0; i < BATCH; i++) {
+      keys[i] = (rnd() % 50 == 0) ? ((rnd() % 2) ? INT_MAX : INT_MIN) : (int) (rnd() % 64) - 32;
+      values[i] = randomValue(rnd);
+      views[i] = values[i];
+    }
+
+    vector<int> expected;
+    for (int i = 0; i < BATCH; i++) {
+      bool pass = true;
+      for (unsigned c = 0; c < cond.size(); c++) pass = pass && holds(cond[c], keys[i], views[i]);
+      if (pass) expected.push_back(i);
+      if (filter.match(keys[i], views[i]) != pass) bad++;
+    }
+
+    vector<int> rows;
+    filter.selectKeys(keys.data(), BATCH, rows);
+    filter.selectValues(views.data(), rows);
+    if (rows != expected) bad++;
+  }
+  CHECK(bad == 0);
+}
+
+// selectKeys() works on batches of any length, including the tails
+// shorter than a vector of keys
+static void testBatchLengths()
+{
+  char lo[] = "3";
+  char hi[] = "40";
+  vector<SelCond> cond(2);
+  cond[0].attr = 1;
+  cond[0].comp = SelCond::GE;
+  cond[0].value = lo;
+  cond[1].attr = 1;
+  cond[1].comp = SelCond::LT;
+  cond[1].value = hi;
+  SelFilter filter(cond);
+
+  vector<int> keys;
+  vector<int> rows;
+  for (int count = 0; count < 70; count++) {
+    filter.selectKeys(keys.data(), keys.size(), rows);
+    int expected = 0;
+    for (int k : keys) expected += (k >= 3 && k < 40);
+    CHECK((int) rows.size() == expected);
+    keys.push_back(count);
+  }
+}
+
+int main()
+{
+  RUN_TEST(testKernels);
+  RUN_TEST(testBatchLengths);
+  return testFailures;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "StringIndex.h"
+#include "TestUtil.h"
+
+using namespace std;
+
+typedef pair<string, RecordId> Entry;
+
+static bool entryLess(const Entry& a, const Entry& b)
+{
+  return a.first != b.first ? a.first < b.first : a.second < b.second;
+}
+
+static bool entryEqual(const Entry& a, const Entry& b)
+{
+  return a.first == b.first && a.second == b.second;
+}
+
+// a range lookup finds every entry of the range, with the keys longer
+// than the longest stored key cut to it, among random keys with many
+// duplicates and long shared prefixes
+static void testRanges()
+{
+  const int KEY_COUNT = 10000;
+  string filename = testFile("string.vidx");
+  mt19937 rnd(7);
+
+  StringIndex idx;
+  CHECK_OK(idx.open(filename, 'w'));
+  int maxLength = idx.getMaxKeyLength();
+  CHECK(maxLength > 0);
+
+  vector<string> inserted;
+  multimap<string, RecordId> expected;
+  for (int i = 0; i < KEY_COUNT; i++) {
+    string key;
+    int kind = rnd() % 10;
+    if (kind < 2 && !inserted.empty()) {
+      key = inserted[rnd() % inserted.size()];
+    } else {
+      int length = (kind == 9) ? maxLength + rnd() % 300 : rnd() % 40;
+      for (int j = 0; j < length; j++) key += (char) ('a' + rnd() % 4);
+      if (kind == 8) key = string(maxLength - 2, 'z') + key;
+    }
+    inserted.push_back(key);
+
+    RecordId rid = { i / 100, i % 100 };
+    CHECK_OK(idx.insert(key, rid));
+    expected.insert(make_pair(key.substr(0, maxLength), rid));
+  }
+  CHECK_OK(idx.close());
+
+  CHECK_OK(idx.open(filename, 'r'));
+  int bad = 0;
+  for (int round = 0; round < 200; round++) {
+    string lo = inserted[rnd() % inserted.size()];
+    string hi = inserted[rnd() % inserted.size()];
+    if (lo > hi) swap(lo, hi);
+    if (round % 7 == 0) lo.resize(lo.size() / 2);
+
+    vector<Entry> want;
+    auto it = expected.lower_bound(lo.substr(0, maxLength));
+    for (; it != expected.end() && it->first <= hi.substr(0, maxLength); ++it) want.push_back(*it);
+
+    vector<Entry> got;
+    StringCursor cursor;
+    vector<string> keys;
+    vector<RecordId> rids;
+    RC rc;
+    CHECK_OK(idx.locate(lo, cursor));
+    while ((rc = idx.readLeafEntries(cursor, &hi, keys, rids)) == 0) {
+      for (unsigned i = 0; i < keys.size(); i++) got.push_back(make_pair(keys[i], rids[i]));
+    }
+    if (rc != RC_END_OF_TREE) bad++;
+
+    sort(want.begin(), want.end(), entryLess);
+    sort(got.begin(), got.end(), entryLess);
+    if (want.size() != got.size() || !equal(want.begin(), want.end(), got.begin(), entryEqual)) bad++;
+  }
+  CHECK(bad == 0);
+
+  // a scan without an upper bound reads all entries in key order
+  StringCursor cursor;
+  vector<string> keys;
+  vector<RecordId> rids;
+  size_t total = 0;
+  string prev;
+  CHECK_OK(idx.locate("", cursor));
+  while (idx.readLeafEntries(cursor, NULL, keys, rids) == 0) {
+    for (unsigned i = 0; i < keys.size(); i++) {
+      if (keys[i] < prev) bad++;
+      prev = keys[i];
+    }
+    total += keys.size();
+  }
+  CHECK(bad == 0);
+  CHECK(total == expected.size());
+  CHECK_OK(idx.close());
+  unlink(filename.c_str());
+}
+
+// a file that is not a StringIndex is refused
+static void testFormat()
+{
+  string filename = testFile("format.vidx");
+  PageFile pf;
+  char page[PageFile::DEFAULT_PAGE_SIZE] = { 0 };
+
+  CHECK_OK(pf.open(filename, 'w'));
+  CHECK_OK(pf.write(0, page));
+  CHECK_OK(pf.close());
+
+  StringIndex idx;
+  CHECK(idx.open(filename, 'r') == RC_INVALID_FILE_FORMAT);
+  unlink(filename.c_str());
+}
+
+int main()
+{
+  RUN_TEST(testRanges);
+  RUN_TEST(testFormat);
+  return testFailures;
+}
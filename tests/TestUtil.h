@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef TESTUTIL_H
+#define TESTUTIL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+/**
+ * The checks shared by the tests under tests/. Each test is a program
+ * that runs its cases from main() and exits with the # of failed checks,
+ * so that "make test" stops at the first test that fails.
+ */
+
+static int testFailures = 0;
+
+// report a failed check and go on with the case
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      testFailures++; \
+    } \
+  } while (0)
+
+// a check of an RC that must be 0
+#define CHECK_OK(rc) CHECK((rc) == 0)
+
+// run a case and print its name
+#define RUN_TEST(fn) \
+  do { \
+    int before = testFailures; \
+    fn(); \
+    printf("%-40s %s\n", #fn, testFailures == before ? "ok" : "FAILED"); \
+  } while (0)
+
+// a file for a test case in the current directory, removed beforehand
+inline std::string testFile(const char* name)
+{
+  std::string filename = std::string("test_") + name;
+  unlink(filename.c_str());
+  return filename;
+}
+
+#endif /* TESTUTIL_H */